@@ -2,6 +2,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
 #include <time.h>
 #include <azureiot/iothub_client_core_common.h>
 #include <azureiot/iothub_client_options.h>
@@ -75,6 +77,43 @@ IOTHUB_DEVICE_CLIENT_LL_HANDLE iothubClientHandle = NULL;
 /// </summary>
 static int keepalivePeriodSeconds = 20;
 
+/// <summary>
+///     Function invoked when there is new work for AzureIoT_DoPeriodicTasks().
+/// </summary>
+static WorkRequestedFnType workRequestedCb = 0;
+
+/// <summary>
+///     DoWork cadence: messages and reported properties handed to the client and not confirmed
+///     yet, whether the client is authenticated, whether it is connecting and since when,
+///     whether something arrived from the IoT Hub since the last DoWork, and the current idle
+///     delay.
+/// </summary>
+static unsigned int messagesInFlight = 0;
+static unsigned int reportsInFlight = 0;
+static bool hubAuthenticated = false;
+static bool hubConnecting = false;
+static uint64_t hubConnectStartMs = 0;
+static bool hubActivity = false;
+static unsigned int idleDelayMs = AZURE_IOT_DOWORK_FAST_MS;
+
+/// <summary>
+///     Telemetry batches, a ring of preallocated message buffers. The members of the queued
+///     events are merged into the JSON object of the open batch, the newest one, so that a
+///     message keeps the shape of a single event. Sealed batches wait oldest first
+///     until the client accepts them, a full ring drops the oldest one.
+/// </summary>
+typedef struct {
+    char payload[AZURE_IOT_BATCH_MAX_BYTES];
+    size_t length;
+    unsigned int events;
+    uint64_t deadlineMs;
+} TelemetryBatch;
+
+static TelemetryBatch batchPool[AZURE_IOT_BATCH_POOL_SIZE];
+static unsigned int batchFirst = 0;
+static unsigned int batchCount = 0;
+static bool batchOpen = false;
+
 /// <summary>
 ///     Set of bundle of root certificate authorities.
 /// </summary>
@@ -163,6 +202,19 @@ static int directMethodCallback(const char *methodName, const unsigned char *pay
 static void hubConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
                                         IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason,
                                         void *userContextCallback);
+static uint64_t GetMonotonicMs(void);
+static void StartConnecting(void);
+static TelemetryBatch *GetOpenBatch(void);
+static bool HasSealedBatches(void);
+static bool NextTopLevelKey(const char *object, size_t length, size_t *position, const char **key,
+                            size_t *keyLength);
+static bool SharesTopLevelKey(const char *object, size_t length, const char *other, size_t otherLength);
+static bool FindListMember(const char *object, size_t length, const char *name, size_t nameLength,
+                           size_t *listEnd);
+static TelemetryBatch *OpenBatch(uint64_t nowMs);
+static void FinishBatchEvent(TelemetryBatch *batch, AzureIoT_TelemetryUrgency urgency, uint64_t nowMs);
+static void SealBatch(void);
+static void SendSealedBatches(void);
 
 #if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
 #define MAXS_SIZE 512
@@ -280,6 +332,8 @@ bool AzureIoT_SetupClient(void)
         return false;
     }
 
+    // The client connects from its first DoWork
+    StartConnecting();
     return true;
 }
 
@@ -292,6 +346,10 @@ void AzureIoT_DestroyClient(void)
         IoTHubDeviceClient_LL_Destroy(iothubClientHandle);
         iothubClientHandle = NULL;
     }
+    messagesInFlight = 0;
+    reportsInFlight = 0;
+    hubAuthenticated = false;
+    hubConnecting = false;
 }
 
 /// <summary>
@@ -333,38 +391,449 @@ void AzureIoT_DoPeriodicTasks(void)
     static time_t lastTimeLogged = 0;
     PeriodicLogVarArgs(&lastTimeLogged, 5, "INFO: %s calls in progress...\n", __func__);
 
+    // Hand the telemetry batches that are due over to the client
+    if (batchOpen && GetMonotonicMs() >= GetOpenBatch()->deadlineMs) {
+        SealBatch();
+    }
+    SendSealedBatches();
+
     // DoWork - send some of the buffered events to the IoT Hub, and receive some of the buffered
     // events from the IoT Hub.
     IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
 }
 
+/// <summary>
+///     Tells when AzureIoT_DoPeriodicTasks() should run next.
+/// </summary>
+/// <remarks>
+///     While messages or reported properties are in flight, sealed telemetry batches wait, or
+///     the IoT Hub just sent something, DoWork runs every AZURE_IOT_DOWORK_FAST_MS. Once idle
+///     the delay doubles on every call, up to half the MQTT keepalive period so that the
+///     PINGREQ is never late, and never past the deadline of the open telemetry batch.
+///     The client moves its TLS and MQTT handshakes forward only inside DoWork, so DoWork also
+///     runs fast while it connects: from its creation or a disconnection until the connection
+///     status reports it authenticated or failed for good, for AZURE_IOT_DOWORK_CONNECT_MAX_MS
+///     at most. Otherwise, while the client is not connected nothing can be delivered: DoWork
+///     backs off up to AZURE_IOT_DOWORK_OFFLINE_MAX_MS and the SDK retry policy paces the
+///     reconnections.
+/// </remarks>
+/// <returns>The delay in milliseconds</returns>
+unsigned int AzureIoT_GetDoWorkDelayMs(void)
+{
+    if (hubConnecting && GetMonotonicMs() - hubConnectStartMs >= AZURE_IOT_DOWORK_CONNECT_MAX_MS) {
+        hubConnecting = false;
+    }
+    unsigned int idleDelayMaxMs = hubAuthenticated ? (unsigned int)keepalivePeriodSeconds * 1000 / 2
+                                                   : AZURE_IOT_DOWORK_OFFLINE_MAX_MS;
+    bool busy = hubConnecting || (hubAuthenticated && (AzureIoT_HasWorkInFlight() || HasSealedBatches()));
+    if (busy || hubActivity) {
+        hubActivity = false;
+        idleDelayMs = AZURE_IOT_DOWORK_FAST_MS;
+        return idleDelayMs;
+    }
+    idleDelayMs *= 2;
+    if (idleDelayMs > idleDelayMaxMs) {
+        idleDelayMs = idleDelayMaxMs;
+    }
+    if (batchOpen) {
+        uint64_t nowMs = GetMonotonicMs();
+        uint64_t deadlineMs = GetOpenBatch()->deadlineMs;
+        uint64_t dueMs = deadlineMs > nowMs ? deadlineMs - nowMs : 0;
+        if (dueMs < idleDelayMs) {
+            return (unsigned int)dueMs;
+        }
+    }
+    return idleDelayMs;
+}
+
+/// <summary>
+///     Whether messages or reported properties are waiting for their confirmation.
+/// </summary>
+bool AzureIoT_HasWorkInFlight(void)
+{
+    return messagesInFlight > 0 || reportsInFlight > 0;
+}
+
+/// <summary>
+///     Sets the function to be invoked whenever new work is handed to the client, so that
+///     AzureIoT_DoPeriodicTasks() is scheduled without waiting for the idle delay.
+/// </summary>
+/// <param name="callback">The function pointer to the callback function.</param>
+void AzureIoT_SetWorkRequestedCallback(WorkRequestedFnType callback)
+{
+    workRequestedCb = callback;
+}
+
+/// <summary>
+///     New work was handed to the client: DoWork should run soon.
+/// </summary>
+static void requestWork(void)
+{
+    idleDelayMs = AZURE_IOT_DOWORK_FAST_MS;
+    if (workRequestedCb) {
+        workRequestedCb();
+    }
+}
+
+/// <summary>
+///     Milliseconds of the monotonic clock, for the telemetry batch deadlines.
+/// </summary>
+static uint64_t GetMonotonicMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+/// <summary>
+///     The client starts a connection: DoWork runs fast until it ends.
+/// </summary>
+static void StartConnecting(void)
+{
+    hubConnecting = true;
+    hubConnectStartMs = GetMonotonicMs();
+}
+
+/// <summary>
+///     The open telemetry batch, the newest one of the ring. Only valid while batchOpen.
+/// </summary>
+static TelemetryBatch *GetOpenBatch(void)
+{
+    return &batchPool[(batchFirst + batchCount - 1) % AZURE_IOT_BATCH_POOL_SIZE];
+}
+
+/// <summary>
+///     Whether telemetry batches are sealed and waiting for the client.
+/// </summary>
+static bool HasSealedBatches(void)
+{
+    return batchCount > (batchOpen ? 1u : 0u);
+}
+
+/// <summary>
+///     Finds the next member name of a JSON object, only the ones of the object itself, not
+///     of nested objects. Start with *position at 0.
+/// </summary>
+/// <param name="position">Where to go on scanning, updated past the member name found.</param>
+/// <param name="key">The member name found, without the quotes and left escaped.</param>
+/// <returns>'true' if a member name was found.</returns>
+static bool NextTopLevelKey(const char *object, size_t length, size_t *position, const char **key,
+                            size_t *keyLength)
+{
+    int depth = (*position == 0) ? 0 : 1;
+    bool expectKey = false;
+    for (size_t i = *position; i < length; i++) {
+        char c = object[i];
+        if (c == '"') {
+            size_t start = ++i;
+            while (i < length && object[i] != '"') {
+                i += (object[i] == '\\') ? 2 : 1;
+            }
+            if (depth == 1 && expectKey) {
+                *key = object + start;
+                *keyLength = i - start;
+                *position = i + 1;
+                return true;
+            }
+        } else if (c == '{' || c == '[') {
+            depth++;
+            expectKey = (depth == 1);
+        } else if (c == '}' || c == ']') {
+            depth--;
+        } else if (c == ',') {
+            expectKey = (depth == 1);
+        }
+    }
+    return false;
+}
+
+/// <summary>
+///     Whether two JSON objects have a member name in common.
+/// </summary>
+static bool SharesTopLevelKey(const char *object, size_t length, const char *other, size_t otherLength)
+{
+    size_t otherPosition = 0;
+    const char *otherKey;
+    size_t otherKeyLength;
+    while (NextTopLevelKey(other, otherLength, &otherPosition, &otherKey, &otherKeyLength)) {
+        size_t position = 0;
+        const char *key;
+        size_t keyLength;
+        while (NextTopLevelKey(object, length, &position, &key, &keyLength)) {
+            if (keyLength == otherKeyLength && memcmp(key, otherKey, keyLength) == 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/// <summary>
+///     Finds a member of a JSON object by name, only among the members of the object itself.
+/// </summary>
+/// <param name="name">The member name, without the quotes.</param>
+/// <param name="listEnd">Where the closing ']' of the member value is, if it is an array.</param>
+/// <returns>'true' if the object has the member, whatever its value.</returns>
+static bool FindListMember(const char *object, size_t length, const char *name, size_t nameLength,
+                           size_t *listEnd)
+{
+    size_t position = 0;
+    const char *key;
+    size_t keyLength;
+    *listEnd = 0;
+    while (NextTopLevelKey(object, length, &position, &key, &keyLength)) {
+        if (keyLength != nameLength || memcmp(key, name, nameLength) != 0) {
+            continue;
+        }
+        size_t i = position;
+        while (i < length && (object[i] == ':' || object[i] == ' ')) {
+            i++;
+        }
+        if (i == length || object[i] != '[') {
+            return true;
+        }
+        int depth = 0;
+        for (; i < length; i++) {
+            char c = object[i];
+            if (c == '"') {
+                i++;
+                while (i < length && object[i] != '"') {
+                    i += (object[i] == '\\') ? 2 : 1;
+                }
+            } else if (c == '{' || c == '[') {
+                depth++;
+            } else if ((c == '}' || c == ']') && --depth == 0) {
+                *listEnd = i;
+                return true;
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+/// <summary>
+///     Opens a new, empty telemetry batch at the head of the ring. A full ring drops its
+///     oldest batch.
+/// </summary>
+static TelemetryBatch *OpenBatch(uint64_t nowMs)
+{
+    if (batchCount == AZURE_IOT_BATCH_POOL_SIZE) {
+        LogMessage("WARNING: telemetry batches full, dropping the oldest one\n");
+        batchFirst = (batchFirst + 1) % AZURE_IOT_BATCH_POOL_SIZE;
+        batchCount--;
+    }
+    batchCount++;
+    batchOpen = true;
+    TelemetryBatch *batch = GetOpenBatch();
+    batch->payload[0] = '{';
+    batch->length = 1;
+    batch->events = 0;
+    batch->deadlineMs = nowMs + AZURE_IOT_BATCH_MAX_AGE_MS;
+    return batch;
+}
+
+/// <summary>
+///     Counts an event added to the open batch. The batch is sealed and sent when it is full
+///     or the event is immediate, otherwise its deadline moves to the one of the event if
+///     that is sooner.
+/// </summary>
+static void FinishBatchEvent(TelemetryBatch *batch, AzureIoT_TelemetryUrgency urgency, uint64_t nowMs)
+{
+    batch->events++;
+    if (urgency == AzureIoT_TelemetryUrgency_Immediate || batch->events >= AZURE_IOT_BATCH_MAX_EVENTS) {
+        SealBatch();
+        SendSealedBatches();
+        return;
+    }
+    uint64_t deadlineMs = nowMs + (urgency == AzureIoT_TelemetryUrgency_Prompt ? AZURE_IOT_BATCH_PROMPT_AGE_MS
+                                                                               : AZURE_IOT_BATCH_MAX_AGE_MS);
+    if (deadlineMs < batch->deadlineMs) {
+        batch->deadlineMs = deadlineMs;
+        // DoWork may be scheduled past the new deadline, let it plan again
+        if (workRequestedCb) {
+            workRequestedCb();
+        }
+    }
+}
+
+/// <summary>
+///     Closes the JSON object of the open telemetry batch. No more events go into it.
+/// </summary>
+static void SealBatch(void)
+{
+    if (!batchOpen) {
+        return;
+    }
+    TelemetryBatch *batch = GetOpenBatch();
+    batch->payload[batch->length++] = '}';
+    batch->payload[batch->length] = '\0';
+    batchOpen = false;
+}
+
+/// <summary>
+///     Hands the sealed telemetry batches over to the client, oldest first. A batch the client
+///     does not accept is kept for the next DoWork, and so are the ones after it.
+/// </summary>
+static void SendSealedBatches(void)
+{
+    if (iothubClientHandle == NULL) {
+        return;
+    }
+    while (HasSealedBatches()) {
+        TelemetryBatch *batch = &batchPool[batchFirst];
+        if (!AzureIoT_SendMessage(batch->payload)) {
+            return;
+        }
+        batchFirst = (batchFirst + 1) % AZURE_IOT_BATCH_POOL_SIZE;
+        batchCount--;
+    }
+}
+
+/// <summary>
+///     Adds the members of a telemetry event to the open batch, opening a new one if there is
+///     none, the event does not fit or the batch already has one of its members.
+/// </summary>
+/// <param name="jsonObject">The event, a flat JSON object. It is copied.</param>
+/// <param name="urgency">How soon the event must be sent.</param>
+/// <returns>'true' if the event was queued.</returns>
+bool AzureIoT_QueueTelemetry(const char *jsonObject, AzureIoT_TelemetryUrgency urgency)
+{
+    size_t length = strlen(jsonObject);
+    if (length < 2 || jsonObject[0] != '{' || jsonObject[length - 1] != '}') {
+        LogMessage("WARNING: telemetry event is not a JSON object\n");
+        return false;
+    }
+    // The members of the event, between the braces
+    const char *members = jsonObject + 1;
+    size_t membersLength = length - 2;
+    // The event alone with its braces and the terminator
+    if (length + 1 > AZURE_IOT_BATCH_MAX_BYTES) {
+        LogMessage("WARNING: telemetry event too long for a batch\n");
+        return false;
+    }
+
+    uint64_t nowMs = GetMonotonicMs();
+    if (batchOpen) {
+        TelemetryBatch *batch = GetOpenBatch();
+        // ',' before the members, then '}' and the terminator
+        if (batch->length + 1 + membersLength + 2 > AZURE_IOT_BATCH_MAX_BYTES ||
+            SharesTopLevelKey(batch->payload, batch->length, jsonObject, length)) {
+            SealBatch();
+            SendSealedBatches();
+        }
+    }
+    TelemetryBatch *batch = batchOpen ? GetOpenBatch() : OpenBatch(nowMs);
+    if (batch->length > 1 && membersLength > 0) {
+        batch->payload[batch->length++] = ',';
+    }
+    memcpy(batch->payload + batch->length, members, membersLength);
+    batch->length += membersLength;
+    FinishBatchEvent(batch, urgency, nowMs);
+    return true;
+}
+
+/// <summary>
+///     Adds a value to the list member of the open batch, so that repeated events of a kind
+///     share one message: {"listName":[value,value,...]}. The member is added to the batch
+///     if it does not have it yet. A new batch is opened if there is none, the value does not
+///     fit or the batch has the member with a value that is not a list.
+/// </summary>
+/// <param name="listName">The member name, without the quotes, it is not escaped.</param>
+/// <param name="jsonValue">The JSON value to add to the list. It is copied.</param>
+/// <param name="urgency">How soon the value must be sent.</param>
+/// <returns>'true' if the value was queued.</returns>
+bool AzureIoT_QueueTelemetryItem(const char *listName, const char *jsonValue, AzureIoT_TelemetryUrgency urgency)
+{
+    size_t nameLength = strlen(listName);
+    size_t valueLength = strlen(jsonValue);
+    // "listName":[value]
+    size_t memberLength = nameLength + valueLength + 5;
+    // The member alone with the braces and the terminator
+    if (valueLength == 0 || memberLength + 3 > AZURE_IOT_BATCH_MAX_BYTES) {
+        LogMessage("WARNING: telemetry list item empty or too long for a batch\n");
+        return false;
+    }
+
+    uint64_t nowMs = GetMonotonicMs();
+    size_t listEnd = 0;
+    if (batchOpen) {
+        TelemetryBatch *batch = GetOpenBatch();
+        bool hasMember = FindListMember(batch->payload, batch->length, listName, nameLength, &listEnd);
+        // ',' before the value or the member, then '}' and the terminator
+        size_t added = listEnd > 0 ? valueLength : memberLength;
+        if ((hasMember && listEnd == 0) || batch->length + 1 + added + 2 > AZURE_IOT_BATCH_MAX_BYTES) {
+            SealBatch();
+            SendSealedBatches();
+            listEnd = 0;
+        }
+    }
+    TelemetryBatch *batch = batchOpen ? GetOpenBatch() : OpenBatch(nowMs);
+    char *payload = batch->payload;
+    if (listEnd > 0) {
+        // Insert ",value" before the ']' of the list, the members after it move along
+        memmove(payload + listEnd + 1 + valueLength, payload + listEnd, batch->length - listEnd);
+        payload[listEnd] = ',';
+        memcpy(payload + listEnd + 1, jsonValue, valueLength);
+        batch->length += 1 + valueLength;
+    } else {
+        if (batch->length > 1) {
+            payload[batch->length++] = ',';
+        }
+        payload[batch->length++] = '"';
+        memcpy(payload + batch->length, listName, nameLength);
+        batch->length += nameLength;
+        memcpy(payload + batch->length, "\":[", 3);
+        batch->length += 3;
+        memcpy(payload + batch->length, jsonValue, valueLength);
+        batch->length += valueLength;
+        payload[batch->length++] = ']';
+    }
+    FinishBatchEvent(batch, urgency, nowMs);
+    return true;
+}
+
+/// <summary>
+///     Closes the open telemetry batch and hands every queued batch over to the client.
+/// </summary>
+void AzureIoT_FlushTelemetry(void)
+{
+    SealBatch();
+    SendSealedBatches();
+}
+
 /// <summary>
 ///     Creates and enqueues a message to be delivered the IoT Hub. The message is not actually sent
 ///     immediately, but it is sent on the next invocation of AzureIoT_DoPeriodicTasks().
 /// </summary>
 /// <param name="messagePayload">The payload of the message to send.</param>
-void AzureIoT_SendMessage(const char *messagePayload)
+bool AzureIoT_SendMessage(const char *messagePayload)
 {
     if (iothubClientHandle == NULL) {
         LogMessage("WARNING: IoT Hub client not initialized\n");
-        return;
+        return false;
     }
 
     IOTHUB_MESSAGE_HANDLE messageHandle = IoTHubMessage_CreateFromString(messagePayload);
 
     if (messageHandle == 0) {
         LogMessage("WARNING: unable to create a new IoTHubMessage\n");
-        return;
+        return false;
     }
 
+    bool accepted = false;
     if (IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle, sendMessageCallback,
                                              /*&callback_param*/ 0) != IOTHUB_CLIENT_OK) {
         LogMessage("WARNING: failed to hand over the message to IoTHubClient\n");
     } else {
         LogMessage("INFO: IoTHubClient accepted the message for delivery\n");
+        messagesInFlight++;
+        requestWork();
+        accepted = true;
     }
 
     IoTHubMessage_Destroy(messageHandle);
+    return accepted;
 }
 
 /// <summary>
@@ -385,6 +854,9 @@ static void reportStatusCallback(int result, void *context)
 {
     LogMessage("INFO: Device Twin reported properties update result: HTTP status code %d\n",
                result);
+    if (reportsInFlight > 0) {
+        reportsInFlight--;
+    }
     if (deviceTwinConfirmationCb)
         deviceTwinConfirmationCb(result);
 }
@@ -435,6 +907,8 @@ void AzureIoT_TwinReportState(const char *propertyName, size_t propertyValue)
         LogMessage("ERROR: failed to set reported property '%s'.\n", propertyName);
     } else {
         LogMessage("INFO: Set reported property '%s' to value %d.\n", propertyName, propertyValue);
+        reportsInFlight++;
+        requestWork();
     }
 
 cleanup:
@@ -472,6 +946,9 @@ void AzureIoT_SetMessageConfirmationCallback(MessageDeliveryConfirmationFnType c
 static void sendMessageCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *context)
 {
     LogMessage("INFO: Message received by IoT Hub. Result is: %d\n", result);
+    if (messagesInFlight > 0) {
+        messagesInFlight--;
+    }
     if (messageDeliveryConfirmationCb) {
         messageDeliveryConfirmationCb(result == IOTHUB_CLIENT_CONFIRMATION_OK);
     }
@@ -490,6 +967,7 @@ static IOTHUBMESSAGE_DISPOSITION_RESULT receiveMessageCallback(IOTHUB_MESSAGE_HA
 {
     const unsigned char *buffer = NULL;
     size_t size = 0;
+    hubActivity = true;
     if (IoTHubMessage_GetByteArray(message, &buffer, &size) != IOTHUB_MESSAGE_OK) {
         LogMessage("WARNING: failure performing IoTHubMessage_GetByteArray\n");
         return IOTHUBMESSAGE_REJECTED;
@@ -545,6 +1023,8 @@ static int directMethodCallback(const char *methodName, const unsigned char *pay
                                 void *userContextCallback)
 {
     LogMessage("INFO: Trying to invoke method %s\n", methodName);
+    // The response goes out on the next DoWork
+    hubActivity = true;
 
     int result = 404;
 
@@ -578,6 +1058,7 @@ static int directMethodCallback(const char *methodName, const unsigned char *pay
 static void twinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payLoad,
                          size_t payLoadSize, void *userContextCallback)
 {
+    hubActivity = true;
     size_t nullTerminatedJsonSize = payLoadSize + 1;
     char *nullTerminatedJsonString = (char *)malloc(nullTerminatedJsonSize);
     if (nullTerminatedJsonString == NULL) {
@@ -634,6 +1115,17 @@ static void hubConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
                                         void *userContextCallback)
 {
     bool authenticated = (result == IOTHUB_CLIENT_CONNECTION_AUTHENTICATED);
+    hubAuthenticated = authenticated;
+    hubActivity = true;
+    // A disabled device, bad credentials and an expired retry policy are final, otherwise
+    // the client reconnects, also to renew its SAS token
+    if (authenticated || reason == IOTHUB_CLIENT_CONNECTION_DEVICE_DISABLED ||
+        reason == IOTHUB_CLIENT_CONNECTION_BAD_CREDENTIAL ||
+        reason == IOTHUB_CLIENT_CONNECTION_RETRY_EXPIRED) {
+        hubConnecting = false;
+    } else {
+        StartConnecting();
+    }
     if (hubConnectionStatusCb) {
         hubConnectionStatusCb(result == IOTHUB_CLIENT_CONNECTION_AUTHENTICATED);
     }
@@ -689,6 +1181,8 @@ void AzureIoT_TwinReportStateJson(
 			}
 			else {
 				LogMessage("INFO: Reported state as '%s'.\n", reportedPropertiesString);
+				reportsInFlight++;
+				requestWork();
 			}
 		}
 		else {
@@ -55,7 +55,67 @@ void AzureIoT_TwinReportState(const char *propertyName, size_t propertyValue);
 ///     immediately, but it is sent on the next invocation of AzureIoT_DoPeriodicTasks().
 /// </summary>
 /// <param name="messagePayload">The payload of the message to send.</param>
-void AzureIoT_SendMessage(const char *messagePayload);
+/// <returns>'true' if the client accepted the message for delivery.</returns>
+bool AzureIoT_SendMessage(const char *messagePayload);
+
+/// <summary>
+///     Telemetry batches: the largest message, in bytes with the braces, the most
+///     events in a message, how long a routine event may wait, how long a prompt event may
+///     wait, and how many batches are kept while the client can not take them.
+/// </summary>
+#ifndef AZURE_IOT_BATCH_MAX_BYTES
+#define AZURE_IOT_BATCH_MAX_BYTES 512
+#endif
+#ifndef AZURE_IOT_BATCH_MAX_EVENTS
+#define AZURE_IOT_BATCH_MAX_EVENTS 16
+#endif
+#ifndef AZURE_IOT_BATCH_MAX_AGE_MS
+#define AZURE_IOT_BATCH_MAX_AGE_MS 60000
+#endif
+#ifndef AZURE_IOT_BATCH_PROMPT_AGE_MS
+#define AZURE_IOT_BATCH_PROMPT_AGE_MS 2000
+#endif
+#ifndef AZURE_IOT_BATCH_POOL_SIZE
+#define AZURE_IOT_BATCH_POOL_SIZE 4
+#endif
+
+/// <summary>
+///     How soon a telemetry event must reach the IoT Hub.
+/// </summary>
+typedef enum {
+    /// <summary>Waits in the batch up to AZURE_IOT_BATCH_MAX_AGE_MS.</summary>
+    AzureIoT_TelemetryUrgency_Routine,
+    /// <summary>Waits up to AZURE_IOT_BATCH_PROMPT_AGE_MS, so that a burst goes in one message.</summary>
+    AzureIoT_TelemetryUrgency_Prompt,
+    /// <summary>Closes the batch and sends it now.</summary>
+    AzureIoT_TelemetryUrgency_Immediate
+} AzureIoT_TelemetryUrgency;
+
+/// <summary>
+///     Adds a telemetry event to the open batch. A batch is sent as a single message, one
+///     JSON object with the members of its events, when it is full, when its oldest event is
+///     due or when an immediate event is added. An event with a member the batch already has
+///     goes into the next batch, so no value is lost.
+/// </summary>
+/// <param name="jsonObject">The event, a flat JSON object. It is copied.</param>
+/// <param name="urgency">How soon the event must be sent.</param>
+/// <returns>'true' if the event was queued.</returns>
+bool AzureIoT_QueueTelemetry(const char *jsonObject, AzureIoT_TelemetryUrgency urgency);
+
+/// <summary>
+///     Adds a value to a list member of the open batch, {"listName":[value,...]}, so that a
+///     burst of events of a kind goes out as one list in one message.
+/// </summary>
+/// <param name="listName">The member name, without the quotes, it is not escaped.</param>
+/// <param name="jsonValue">The JSON value to add to the list. It is copied.</param>
+/// <param name="urgency">How soon the value must be sent.</param>
+/// <returns>'true' if the value was queued.</returns>
+bool AzureIoT_QueueTelemetryItem(const char *listName, const char *jsonValue, AzureIoT_TelemetryUrgency urgency);
+
+/// <summary>
+///     Closes the open batch and hands every queued batch over to the client.
+/// </summary>
+void AzureIoT_FlushTelemetry(void);
 
 /// <summary>
 ///     Keeps IoT Hub Client alive by exchanging data with the Azure IoT Hub.
@@ -67,6 +127,47 @@ void AzureIoT_SendMessage(const char *messagePayload);
 /// </remarks>
 void AzureIoT_DoPeriodicTasks(void);
 
+/// <summary>
+///     Period of AzureIoT_DoPeriodicTasks() while the client connects or the connected client
+///     has work in flight, longest time a connection may take at that period, and longest
+///     period while it is not connected.
+/// </summary>
+#ifndef AZURE_IOT_DOWORK_FAST_MS
+#define AZURE_IOT_DOWORK_FAST_MS 100
+#endif
+#ifndef AZURE_IOT_DOWORK_CONNECT_MAX_MS
+#define AZURE_IOT_DOWORK_CONNECT_MAX_MS 30000
+#endif
+#ifndef AZURE_IOT_DOWORK_OFFLINE_MAX_MS
+#define AZURE_IOT_DOWORK_OFFLINE_MAX_MS 5000
+#endif
+
+/// <summary>
+///     Tells when AzureIoT_DoPeriodicTasks() should run next: every AZURE_IOT_DOWORK_FAST_MS
+///     while the client connects or there is work, backing off up to half the MQTT keepalive
+///     period when idle and up to AZURE_IOT_DOWORK_OFFLINE_MAX_MS when not connected.
+/// </summary>
+/// <returns>The delay in milliseconds</returns>
+unsigned int AzureIoT_GetDoWorkDelayMs(void);
+
+/// <summary>
+///     Whether messages or reported properties sent to the IoT Hub are waiting for their
+///     delivery confirmation.
+/// </summary>
+bool AzureIoT_HasWorkInFlight(void);
+
+/// <summary>
+///     Type of the function callback invoked when new work is handed to the client.
+/// </summary>
+typedef void (*WorkRequestedFnType)(void);
+
+/// <summary>
+///     Sets the function to be invoked whenever a message or a reported property is handed to
+///     the client, so that AzureIoT_DoPeriodicTasks() runs without waiting for the idle delay.
+/// </summary>
+/// <param name="callback">The function pointer to the callback function.</param>
+void AzureIoT_SetWorkRequestedCallback(WorkRequestedFnType callback);
+
 /// <summary>
 ///     Type of the function callback invoked whenever a message is received from IoT Hub.
 /// </summary>
@@ -35,3 +35,12 @@
 #ifdef VCNL4040_PROXIMITY_INCLUDED
 #warning "Building for a VCNL4040 sensor at ISU2."
 #endif 
+
+// Token shown in the QR code. By default an HS256 JSON Web Token is used. Enable this define
+// for the compact binary profile: device index (4th command line argument), jti, iat and a
+// 64 bit truncated HMAC-SHA256 in 19 bytes. Decode it with tools/iwt_compact_token.py
+//#define IWT_COMPACT_TOKEN_PROFILE
+
+#ifdef IWT_COMPACT_TOKEN_PROFILE
+#warning "Building for compact binary tokens."
+#endif 
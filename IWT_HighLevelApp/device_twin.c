@@ -21,6 +21,8 @@
 #include "azure_iot_utilities.h"
 #include "parson.h"
 #include "build_options.h"
+#include "iwt_fill_level.h"
+#include "iwt_telemetry.h"
 
 bool userLedRedIsOn = false;
 bool userLedGreenIsOn = false;
@@ -36,6 +38,14 @@ uint8_t oled_ms2[CLOUD_MSG_SIZE];
 uint8_t oled_ms3[CLOUD_MSG_SIZE];
 uint8_t oled_ms4[CLOUD_MSG_SIZE];
 
+//// Bin fill level calibration, proximity counts of the empty and the full bin
+int binEmptyCount = IWT_FILL_LEVEL_EMPTY_COUNT;
+int binFullCount = IWT_FILL_LEVEL_FULL_COUNT;
+
+//// FillLevel telemetry, percent change worth a message and longest time without one
+int fillLevelDeadband = IWT_TELEMETRY_DEADBAND;
+int fillLevelHeartbeatMinutes = IWT_TELEMETRY_HEARTBEAT_MS / 60000;
+
 extern int userLedRedFd;
 extern int userLedGreenFd;
 extern int userLedBlueFd;
@@ -79,7 +89,11 @@ twin_t twinArray[] = {
 	{.twinKey = "OledDisplayMsg1",.twinVar = oled_ms1,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_STRING,.active_high = true},
 	{.twinKey = "OledDisplayMsg2",.twinVar = oled_ms2,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_STRING,.active_high = true},
 	{.twinKey = "OledDisplayMsg3",.twinVar = oled_ms3,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_STRING,.active_high = true},
-	{.twinKey = "OledDisplayMsg4",.twinVar = oled_ms4,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_STRING,.active_high = true}
+	{.twinKey = "OledDisplayMsg4",.twinVar = oled_ms4,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_STRING,.active_high = true},
+	{.twinKey = "binEmptyCount",.twinVar = &binEmptyCount,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_INT,.active_high = true},
+	{.twinKey = "binFullCount",.twinVar = &binFullCount,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_INT,.active_high = true},
+	{.twinKey = "fillLevelDeadband",.twinVar = &fillLevelDeadband,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_INT,.active_high = true},
+	{.twinKey = "fillLevelHeartbeatMinutes",.twinVar = &fillLevelHeartbeatMinutes,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_INT,.active_high = true}
 };
 
 // Calculate how many twin_t items are in the array.  We use this to iterate through the structure.
@@ -15,6 +15,11 @@
 *   EPD_DC -> EPD_DC_PIN
 *   EPD_CS -> EPD_CS_PIN
 *   EPD_BUSY -> EPD_BUSY_PIN
+* 4.Change: frames, LUTs and register settings are written in bulk SPI
+*   transfers, DC is only toggled between a command and its data
+* 5.Change: EPD_TurnOnDisplay is split in EPD_StartDisplay and
+*   EPD_WaitUntilIdle, EPD_IsBusy lets the caller poll the refresh
+* 6.Change: EPD_SetLut switches the waveform of an awake panel
 #
 # Permission is hereby granted, free of charge, to any person obtaining a copy
 # of this software and associated documnetation files (the "Software"), to deal
@@ -36,12 +41,20 @@
 #
 ******************************************************************************/
 #include "EPD_1in54.h"
+#include <string.h>
 
 
 static int spiFd = -1;
 static int resetPinFd = -1;
 static int dcPinFd = -1;
 static int busyPinFd = -1;
+static int dcLevel = -1;    // Last level written to the DC pin, -1 if unknown
+
+// Largest write the ISU SPI master takes in a single transfer
+#define EPD_SPI_TRANSFER_MAX    4096
+
+// Staging buffer of a whole frame for the writes built by the driver, off the stack
+static UBYTE stagingFrame[((EPD_WIDTH % 8 == 0)? (EPD_WIDTH / 8 ): (EPD_WIDTH / 8 + 1)) * EPD_HEIGHT];
 
 const unsigned char lut_full_update[] = {
     0x02, 0x02, 0x01, 0x11, 0x12, 0x12, 0x22, 0x22,
@@ -77,28 +90,55 @@ int DEV_Digital_Read(int gpioFd ) {
 
 void DEV_Delay_ms(int delayTime) {
 	struct timespec ts;
-	ts.tv_sec = 0;
-	ts.tv_nsec = delayTime * 10000;
+	ts.tv_sec = delayTime / 1000;
+	ts.tv_nsec = (long)(delayTime % 1000) * 1000000;
 	nanosleep(&ts, NULL);
 }
 
-int DEV_SPI_WriteByte(UBYTE toWrite) {
-	uint8_t data[1];
-	data[0] = toWrite;
-	const size_t transferCount = 1;
-	SPIMaster_Transfer transfer;
-
-	int result = SPIMaster_InitTransfers(&transfer, transferCount);
-	if (result != 0) {
-		return -1;
-	}
+/******************************************************************************
+function :	Write a buffer to the SPI bus
+parameter:
+    data   : Bytes to write
+    length : Number of bytes, split in transfers of up to EPD_SPI_TRANSFER_MAX
+******************************************************************************/
+static int DEV_SPI_Write(const UBYTE *data, UDOUBLE length)
+{
+    while (length > 0) {
+        size_t chunk = (length < EPD_SPI_TRANSFER_MAX) ? length : EPD_SPI_TRANSFER_MAX;
+        SPIMaster_Transfer transfer;
+        if (SPIMaster_InitTransfers(&transfer, 1) != 0) {
+            return -1;
+        }
+        transfer.flags = SPI_TransferFlags_Write;
+        transfer.writeData = data;
+        transfer.length = chunk;
+
+        ssize_t transferredBytes = SPIMaster_TransferSequential(spiFd, &transfer, 1);
+        if (transferredBytes != (ssize_t)chunk) {
+            Log_Debug("ERROR: SPI write of %d bytes failed: %s (%d)\r\n", (int)chunk, strerror(errno), errno);
+            return -1;
+        }
+        data += chunk;
+        length -= chunk;
+    }
+    return 0;
+}
 
-	transfer.flags = SPI_TransferFlags_Write;
-	transfer.writeData = data;
-	transfer.length = 1;
+static int DEV_SPI_WriteByte(UBYTE toWrite) {
+	return DEV_SPI_Write(&toWrite, 1);
+}
 
-	ssize_t transferredBytes = SPIMaster_TransferSequential(spiFd, &transfer, transferCount);
-	return 0;
+/******************************************************************************
+function :	Set the DC pin, skipping the write if it already has that level
+parameter:
+    level : 0 command, 1 data
+******************************************************************************/
+static void EPD_SetDC(int level)
+{
+    if (level != dcLevel) {
+        DEV_Digital_Write(dcPinFd, level);
+        dcLevel = level;
+    }
 }
 
 /******************************************************************************
@@ -108,11 +148,11 @@ parameter:
 static void EPD_Reset(void)
 {
     DEV_Digital_Write(resetPinFd, 1);
-    DEV_Delay_ms(200);
+    DEV_Delay_ms(20);
     DEV_Digital_Write(resetPinFd, 0);
-    DEV_Delay_ms(200);
+    DEV_Delay_ms(2);
     DEV_Digital_Write(resetPinFd, 1);
-    DEV_Delay_ms(200);
+    DEV_Delay_ms(20);
 }
 
 /******************************************************************************
@@ -122,10 +162,8 @@ parameter:
 ******************************************************************************/
 static void EPD_SendCommand(UBYTE Reg)
 {
-    DEV_Digital_Write(dcPinFd, 0);
-    //DEV_Digital_Write(EPD_CS_PIN, 0);
+    EPD_SetDC(0);
     DEV_SPI_WriteByte(Reg);
-    //DEV_Digital_Write(EPD_CS_PIN, 1);
 }
 
 /******************************************************************************
@@ -135,10 +173,43 @@ parameter:
 ******************************************************************************/
 static void EPD_SendData(UBYTE Data)
 {
-    DEV_Digital_Write(dcPinFd, 1);
-    //DEV_Digital_Write(EPD_CS_PIN, 0);
+    EPD_SetDC(1);
     DEV_SPI_WriteByte(Data);
-    //DEV_Digital_Write(EPD_CS_PIN, 1);
+}
+
+/******************************************************************************
+function :	send data buffer, in one go
+parameter:
+    Data   : Data to write
+    Length : Number of bytes
+******************************************************************************/
+static void EPD_SendDataBuffer(const UBYTE *Data, UDOUBLE Length)
+{
+    EPD_SetDC(1);
+    DEV_SPI_Write(Data, Length);
+}
+
+/******************************************************************************
+function :	send a command followed by its data
+parameter:
+    Reg    : Command register
+    Data   : Command parameters
+    Length : Number of bytes of Data
+******************************************************************************/
+static void EPD_SendCommandData(UBYTE Reg, const UBYTE *Data, UDOUBLE Length)
+{
+    EPD_SendCommand(Reg);
+    EPD_SendDataBuffer(Data, Length);
+}
+
+/******************************************************************************
+function :	Read the busy_pin
+parameter:
+return   :  1 while the panel is busy, 0 when it is idle
+******************************************************************************/
+UBYTE EPD_IsBusy(void)
+{
+    return DEV_Digital_Read(busyPinFd) == 1;      //LOW: idle, HIGH: busy
 }
 
 /******************************************************************************
@@ -148,8 +219,8 @@ parameter:
 void EPD_WaitUntilIdle(void)
 {
     Log_Debug("e-Paper busy\r\n");
-    while(DEV_Digital_Read(busyPinFd) == 1) {      //LOW: idle, HIGH: busy
-        DEV_Delay_ms(100);
+    while(EPD_IsBusy()) {
+        DEV_Delay_ms(10);
     }
     Log_Debug("e-Paper busy release\r\n");
 }
@@ -160,15 +231,10 @@ parameter:
 ******************************************************************************/
 static void EPD_SetWindows(UWORD Xstart, UWORD Ystart, UWORD Xend, UWORD Yend)
 {
-    EPD_SendCommand(SET_RAM_X_ADDRESS_START_END_POSITION);
-    EPD_SendData((Xstart >> 3) & 0xFF);
-    EPD_SendData((Xend >> 3) & 0xFF);
-
-    EPD_SendCommand(SET_RAM_Y_ADDRESS_START_END_POSITION);
-    EPD_SendData(Ystart & 0xFF);
-    EPD_SendData((Ystart >> 8) & 0xFF);
-    EPD_SendData(Yend & 0xFF);
-    EPD_SendData((Yend >> 8) & 0xFF);
+    const UBYTE X[] = {(Xstart >> 3) & 0xFF, (Xend >> 3) & 0xFF};
+    const UBYTE Y[] = {Ystart & 0xFF, (Ystart >> 8) & 0xFF, Yend & 0xFF, (Yend >> 8) & 0xFF};
+    EPD_SendCommandData(SET_RAM_X_ADDRESS_START_END_POSITION, X, sizeof(X));
+    EPD_SendCommandData(SET_RAM_Y_ADDRESS_START_END_POSITION, Y, sizeof(Y));
 }
 
 /******************************************************************************
@@ -177,26 +243,32 @@ parameter:
 ******************************************************************************/
 static void EPD_SetCursor(UWORD Xstart, UWORD Ystart)
 {
-    EPD_SendCommand(SET_RAM_X_ADDRESS_COUNTER);
-    EPD_SendData((Xstart >> 3) & 0xFF);
-
-    EPD_SendCommand(SET_RAM_Y_ADDRESS_COUNTER);
-    EPD_SendData(Ystart & 0xFF);
-    EPD_SendData((Ystart >> 8) & 0xFF);
-
+    const UBYTE X[] = {(Xstart >> 3) & 0xFF};
+    const UBYTE Y[] = {Ystart & 0xFF, (Ystart >> 8) & 0xFF};
+    EPD_SendCommandData(SET_RAM_X_ADDRESS_COUNTER, X, sizeof(X));
+    EPD_SendCommandData(SET_RAM_Y_ADDRESS_COUNTER, Y, sizeof(Y));
 }
 
 /******************************************************************************
-function :	Turn On Display
+function :	Start the display refresh and return at once. The panel stays
+            busy until the refresh is over, see EPD_IsBusy
 parameter:
 ******************************************************************************/
-void EPD_TurnOnDisplay(void)
+void EPD_StartDisplay(void)
 {
     EPD_SendCommand(DISPLAY_UPDATE_CONTROL_2);
     EPD_SendData(0xC4);
     EPD_SendCommand(MASTER_ACTIVATION);
     EPD_SendCommand(TERMINATE_FRAME_READ_WRITE);
+}
 
+/******************************************************************************
+function :	Turn On Display
+parameter:
+******************************************************************************/
+void EPD_TurnOnDisplay(void)
+{
+    EPD_StartDisplay();
     EPD_WaitUntilIdle();
 }
 
@@ -210,34 +282,39 @@ UBYTE EPD_Init(const unsigned char* lut, const SpiMasterConfigType * spiMasterCo
 	busyPinFd = spiMasterConfig->busyFd;
 	dcPinFd = spiMasterConfig->dcFd;
 	resetPinFd = spiMasterConfig->resetFd;
+	dcLevel = -1;
 
     EPD_Reset();
 
-    EPD_SendCommand(DRIVER_OUTPUT_CONTROL);
-    EPD_SendData((EPD_HEIGHT - 1) & 0xFF);
-    EPD_SendData(((EPD_HEIGHT - 1) >> 8) & 0xFF);
-    EPD_SendData(0x00);                     // GD = 0; SM = 0; TB = 0;
-    EPD_SendCommand(BOOSTER_SOFT_START_CONTROL);
-    EPD_SendData(0xD7);
-    EPD_SendData(0xD6);
-    EPD_SendData(0x9D);
-    EPD_SendCommand(WRITE_VCOM_REGISTER);
-    EPD_SendData(0xA8);                     // VCOM 7C
-    EPD_SendCommand(SET_DUMMY_LINE_PERIOD);
-    EPD_SendData(0x1A);                     // 4 dummy lines per gate
-    EPD_SendCommand(SET_GATE_TIME);
-    EPD_SendData(0x08);                     // 2us per line
-    EPD_SendCommand(DATA_ENTRY_MODE_SETTING);
-    EPD_SendData(0x03);
-
-    //set the look-up table register
-    EPD_SendCommand(WRITE_LUT_REGISTER);
-    for (UWORD i = 0; i < 30; i++) {
-        EPD_SendData(lut[i]);
-    }
+    static const UBYTE DriverOutput[] = {(EPD_HEIGHT - 1) & 0xFF, ((EPD_HEIGHT - 1) >> 8) & 0xFF,
+                                         0x00};     // GD = 0; SM = 0; TB = 0;
+    static const UBYTE BoosterSoftStart[] = {0xD7, 0xD6, 0x9D};
+    static const UBYTE Vcom[] = {0xA8};             // VCOM 7C
+    static const UBYTE DummyLinePeriod[] = {0x1A};  // 4 dummy lines per gate
+    static const UBYTE GateTime[] = {0x08};         // 2us per line
+    static const UBYTE DataEntryMode[] = {0x03};    // X then Y increment
+    EPD_SendCommandData(DRIVER_OUTPUT_CONTROL, DriverOutput, sizeof(DriverOutput));
+    EPD_SendCommandData(BOOSTER_SOFT_START_CONTROL, BoosterSoftStart, sizeof(BoosterSoftStart));
+    EPD_SendCommandData(WRITE_VCOM_REGISTER, Vcom, sizeof(Vcom));
+    EPD_SendCommandData(SET_DUMMY_LINE_PERIOD, DummyLinePeriod, sizeof(DummyLinePeriod));
+    EPD_SendCommandData(SET_GATE_TIME, GateTime, sizeof(GateTime));
+    EPD_SendCommandData(DATA_ENTRY_MODE_SETTING, DataEntryMode, sizeof(DataEntryMode));
+
+    EPD_SetLut(lut);
     return 0;
 }
 
+/******************************************************************************
+function :	Set the look-up table register, e.g. to switch between the full
+            and the partial waveform without a new EPD_Init
+parameter:
+    lut : 30 bytes, lut_full_update or lut_partial_update
+******************************************************************************/
+void EPD_SetLut(const unsigned char* lut)
+{
+    EPD_SendCommandData(WRITE_LUT_REGISTER, lut, 30);
+}
+
 /******************************************************************************
 function :	Clear screen
 parameter:
@@ -247,14 +324,13 @@ void EPD_Clear(void)
     UWORD Width, Height;
     Width = (EPD_WIDTH % 8 == 0)? (EPD_WIDTH / 8 ): (EPD_WIDTH / 8 + 1);
     Height = EPD_HEIGHT;
-    EPD_SetWindows(0, 0, EPD_WIDTH, EPD_HEIGHT);
-    for (UWORD j = 0; j < Height; j++) {
-        EPD_SetCursor(0, j);
-        EPD_SendCommand(WRITE_RAM);
-        for (UWORD i = 0; i < Width; i++) {
-            EPD_SendData(0XFF);
-        }
-    }
+    memset(stagingFrame, 0xFF, sizeof(stagingFrame));
+
+    // The address counter wraps to the next row at the window edge by itself,
+    // so the window must end on the last pixel and the frame goes in one stream
+    EPD_SetWindows(0, 0, EPD_WIDTH - 1, EPD_HEIGHT - 1);
+    EPD_SetCursor(0, 0);
+    EPD_SendCommandData(WRITE_RAM, stagingFrame, (UDOUBLE)Width * Height);
     EPD_TurnOnDisplay();
 }
 
@@ -268,20 +344,42 @@ void EPD_Display(UBYTE *Image)
     Width = (EPD_WIDTH % 8 == 0)? (EPD_WIDTH / 8 ): (EPD_WIDTH / 8 + 1);
     Height = EPD_HEIGHT;
 
-    UDOUBLE Addr = 0;
-    // UDOUBLE Offset = ImageName;
-    EPD_SetWindows(0, 0, EPD_WIDTH, EPD_HEIGHT);
-    for (UWORD j = 0; j < Height; j++) {
-        EPD_SetCursor(0, j);
-        EPD_SendCommand(WRITE_RAM);
-        for (UWORD i = 0; i < Width; i++) {
-            Addr = i + j * Width;
-            EPD_SendData(Image[Addr]);
-        }
-    }
+    // The address counter wraps to the next row at the window edge by itself,
+    // so the window must end on the last pixel and the frame goes in one stream
+    EPD_SetWindows(0, 0, EPD_WIDTH - 1, EPD_HEIGHT - 1);
+    EPD_SetCursor(0, 0);
+    EPD_SendCommandData(WRITE_RAM, Image, (UDOUBLE)Width * Height);
     EPD_TurnOnDisplay();
 }
 
+/******************************************************************************
+function :	Sends a window of the image buffer in RAM to the e-Paper RAM,
+            without refreshing the display
+parameter:
+    Image  : Whole frame, EPD_WIDTH / 8 bytes per row
+    Xstart : First column, rounded down to a multiple of 8
+    Ystart : First row
+    Xend   : Last column, included
+    Yend   : Last row, included
+******************************************************************************/
+void EPD_WriteWindow(const UBYTE *Image, UWORD Xstart, UWORD Ystart, UWORD Xend, UWORD Yend)
+{
+    UWORD Width = (EPD_WIDTH % 8 == 0)? (EPD_WIDTH / 8 ): (EPD_WIDTH / 8 + 1);
+    UWORD First = Xstart / 8, Bytes = Xend / 8 - Xstart / 8 + 1;
+
+    // Rows of the window are packed in the staging buffer so that the window goes in one
+    // stream too
+    UDOUBLE Length = 0;
+    for (UWORD j = Ystart; j <= Yend; j++) {
+        memcpy(&stagingFrame[Length], &Image[j * Width + First], Bytes);
+        Length += Bytes;
+    }
+
+    EPD_SetWindows(Xstart, Ystart, Xend, Yend);
+    EPD_SetCursor(Xstart, Ystart);
+    EPD_SendCommandData(WRITE_RAM, stagingFrame, Length);
+}
+
 /******************************************************************************
 function :	Enter sleep mode
 parameter:
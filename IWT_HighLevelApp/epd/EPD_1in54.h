@@ -80,11 +80,16 @@ typedef struct   {
 } SpiMasterConfigType;
 
 UBYTE EPD_Init(const unsigned char* lut, const SpiMasterConfigType *spiMasterConfig);
+void EPD_SetLut(const unsigned char* lut);
 void EPD_Clear(void);
 void EPD_Display(UBYTE *Image);
+void EPD_WriteWindow(const UBYTE *Image, UWORD Xstart, UWORD Ystart, UWORD Xend, UWORD Yend);
 void EPD_Sleep(void);
 unsigned char* LUT_FULL_UPDATE();
 unsigned char* LUT_PARTIAL_UPDATE();
 void DEV_Delay_ms(int delayTime);
 void EPD_TurnOnDisplay(void);
+void EPD_StartDisplay(void);
+void EPD_WaitUntilIdle(void);
+UBYTE EPD_IsBusy(void);
 #endif
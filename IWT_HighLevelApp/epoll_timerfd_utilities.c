@@ -8,6 +8,50 @@
 #include <applibs/log.h>
 #include "epoll_timerfd_utilities.h"
 
+static EventLoopStats loopStats;
+
+static uint64_t GetMonotonicNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static void UpdateHandlerStats(EventHandlerStats *stats, uint64_t runTimeNs, uint64_t delayNs)
+{
+    stats->calls++;
+    stats->runTimeNs += runTimeNs;
+    if (runTimeNs > stats->maxRunTimeNs) {
+        stats->maxRunTimeNs = (uint32_t)(runTimeNs > UINT32_MAX ? UINT32_MAX : runTimeNs);
+    }
+    stats->delayNs += delayNs;
+    if (delayNs > stats->maxDelayNs) {
+        stats->maxDelayNs = (uint32_t)(delayNs > UINT32_MAX ? UINT32_MAX : delayNs);
+    }
+}
+
+/// <summary>
+///     Calls the handler of every ready event, timing each one.
+/// </summary>
+static void DispatchEvents(const struct epoll_event *events, int numEvents)
+{
+    uint64_t wakeup = GetMonotonicNs();
+    uint64_t start = wakeup;
+    for (int i = 0; i < numEvents; i++) {
+        EventData *eventData = events[i].data.ptr;
+        if (eventData == NULL) {
+            continue;
+        }
+        eventData->eventHandler(eventData);
+        uint64_t end = GetMonotonicNs();
+        UpdateHandlerStats(&eventData->stats, end - start, start - wakeup);
+        start = end;
+    }
+    loopStats.wakeups++;
+    loopStats.events += (uint32_t)numEvents;
+    loopStats.dispatchTimeNs += start - wakeup;
+}
+
 int CreateEpollFd(void)
 {
     int epollFd = -1;
@@ -121,8 +165,8 @@ int CreateTimerFdAndAddToEpoll(int epollFd, const struct timespec *period,
 
 int WaitForEventAndCallHandler(int epollFd)
 {
-    struct epoll_event event;
-    int numEventsOccurred = epoll_wait(epollFd, &event, 1, -1);
+    struct epoll_event events[EPOLL_DISPATCH_MAX_EVENTS];
+    int numEventsOccurred = epoll_wait(epollFd, events, EPOLL_DISPATCH_MAX_EVENTS, -1);
 
     if (numEventsOccurred == -1) {
         if (errno == EINTR) {
@@ -133,14 +177,350 @@ int WaitForEventAndCallHandler(int epollFd)
         return -1;
     }
 
-    if (numEventsOccurred == 1 && event.data.ptr != NULL) {
-        EventData *eventData = event.data.ptr;
-        eventData->eventHandler(eventData);
+    if (numEventsOccurred > 0) {
+        DispatchEvents(events, numEventsOccurred);
     }
 
     return 0;
 }
 
+int WaitForEventOrRunIdleHandler(int epollFd, IdleHandler idleHandler)
+{
+    struct epoll_event events[EPOLL_DISPATCH_MAX_EVENTS];
+    int timeout = (idleHandler == NULL) ? -1 : 0;
+
+    for (;;) {
+        int numEventsOccurred = epoll_wait(epollFd, events, EPOLL_DISPATCH_MAX_EVENTS, timeout);
+
+        if (numEventsOccurred == -1) {
+            if (errno == EINTR) {
+                // interrupted by signal, e.g. due to breakpoint being set; ignore
+                return 0;
+            }
+            Log_Debug("ERROR: Failed waiting on events: %s (%d).\n", strerror(errno), errno);
+            return -1;
+        }
+
+        if (numEventsOccurred > 0) {
+            DispatchEvents(events, numEventsOccurred);
+            return 0;
+        }
+
+        // Nothing ready: do one step of idle work, block once there is none left
+        loopStats.idleSteps++;
+        if (!idleHandler()) {
+            timeout = -1;
+        }
+    }
+}
+
+void LogEventHandlerStats(EventHandlerStats *stats, const char *name)
+{
+    if (stats->calls > 0) {
+        Log_Debug("Handler %s: %u calls, run %u us avg %u us max, delay %u us avg %u us max\n", name,
+                  stats->calls, (unsigned int)(stats->runTimeNs / stats->calls / 1000),
+                  stats->maxRunTimeNs / 1000, (unsigned int)(stats->delayNs / stats->calls / 1000),
+                  stats->maxDelayNs / 1000);
+    }
+    memset(stats, 0, sizeof(*stats));
+}
+
+void LogEventLoopStats(void)
+{
+    Log_Debug("Event loop: %u wakeups, %u events, %u idle steps, %u us dispatching\n",
+              loopStats.wakeups, loopStats.events, loopStats.idleSteps,
+              (unsigned int)(loopStats.dispatchTimeNs / 1000));
+    memset(&loopStats, 0, sizeof(loopStats));
+}
+
+// Timer wheel.
+//
+// Level 0 holds the timers expiring in the next 64 ms, one slot per ms. Level n holds the
+// timers expiring within 64^(n+1) ms, one slot per 64^n ms, and a slot is moved down a level,
+// cascaded, when the time reaches its start. A bitmap per level tells the occupied slots,
+// so the wheel skips empty slots and finds the next expiry with a few bit scans. The timerfd
+// is armed on the absolute time of that expiry, once per wakeup.
+
+#define TIMER_WHEEL_SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_RANGE (1ull << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS))
+
+static struct {
+    int timerFd;
+    EventData eventData;
+    struct timespec start;
+    uint64_t now;
+    uint64_t armedTick;
+    bool dispatching;
+    uint64_t occupied[TIMER_WHEEL_LEVELS];
+    Timer *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} wheel = {.timerFd = -1};
+
+/// <summary>
+///     Milliseconds elapsed since the wheel was created.
+/// </summary>
+static uint64_t GetWheelTick(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    // Nanoseconds first: the nanosecond difference alone may be negative, and dividing it
+    // would round the tick up
+    int64_t elapsedNs = (int64_t)(now.tv_sec - wheel.start.tv_sec) * 1000000000 +
+                        (now.tv_nsec - wheel.start.tv_nsec);
+    return (uint64_t)elapsedNs / 1000000;
+}
+
+static void LinkTimer(Timer *timer, int level, int slot)
+{
+    Timer **head = &wheel.slots[level][slot];
+    timer->level = (uint8_t)level;
+    timer->slot = (uint8_t)slot;
+    timer->next = *head;
+    if (*head != NULL) {
+        (*head)->pprev = &timer->next;
+    }
+    timer->pprev = head;
+    *head = timer;
+    wheel.occupied[level] |= 1ull << slot;
+}
+
+static void UnlinkTimer(Timer *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next != NULL) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+    if (wheel.slots[timer->level][timer->slot] == NULL) {
+        wheel.occupied[timer->level] &= ~(1ull << timer->slot);
+    }
+}
+
+/// <summary>
+///     Puts a timer in the slot of its expiry, at the lowest level that reaches it.
+/// </summary>
+static void InsertTimer(Timer *timer)
+{
+    uint64_t expiry = timer->expiry;
+    if (expiry - wheel.now >= TIMER_WHEEL_RANGE) {
+        // Parked at the last level, it is placed again when that slot cascades
+        expiry = wheel.now + TIMER_WHEEL_RANGE - 1;
+    }
+    uint64_t delta = expiry - wheel.now;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ull << (TIMER_WHEEL_SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+    LinkTimer(timer, level, (int)((expiry >> (TIMER_WHEEL_SLOT_BITS * level)) & TIMER_WHEEL_SLOT_MASK));
+}
+
+/// <summary>
+///     Distance, 1 to 64, from a slot to the next occupied slot of a level, 0 if it is empty.
+/// </summary>
+static int NextOccupiedSlot(int level, int slot)
+{
+    uint64_t bits = wheel.occupied[level];
+    if (bits == 0) {
+        return 0;
+    }
+    // Rotate so that the slot after the current one comes first
+    int shift = (slot + 1) & TIMER_WHEEL_SLOT_MASK;
+    uint64_t rotated = shift == 0 ? bits : (bits >> shift) | (bits << (TIMER_WHEEL_SLOTS - shift));
+    return __builtin_ctzll(rotated) + 1;
+}
+
+/// <summary>
+///     Tick of the next expiry, or of the next cascade that has timers to move.
+/// </summary>
+/// <returns>The tick, or 0 if no timer is armed</returns>
+static uint64_t GetNextWheelTick(void)
+{
+    uint64_t next = 0;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        int shift = TIMER_WHEEL_SLOT_BITS * level;
+        int distance = NextOccupiedSlot(level, (int)((wheel.now >> shift) & TIMER_WHEEL_SLOT_MASK));
+        if (distance > 0) {
+            uint64_t tick = ((wheel.now >> shift) + (uint64_t)distance) << shift;
+            if (next == 0 || tick < next) {
+                next = tick;
+            }
+        }
+    }
+    return next;
+}
+
+/// <summary>
+///     Arms the timerfd on the next tick of the wheel, unless it is armed on it already.
+/// </summary>
+static void RearmTimerWheel(void)
+{
+    uint64_t next = GetNextWheelTick();
+    if (next == wheel.armedTick || wheel.timerFd < 0) {
+        return;
+    }
+    struct itimerspec value = {.it_interval = {0, 0}};
+    if (next != 0) {
+        value.it_value.tv_sec = wheel.start.tv_sec + (time_t)(next / 1000);
+        value.it_value.tv_nsec = wheel.start.tv_nsec + (long)(next % 1000) * 1000000;
+        if (value.it_value.tv_nsec >= 1000000000) {
+            value.it_value.tv_sec++;
+            value.it_value.tv_nsec -= 1000000000;
+        }
+    }
+    if (timerfd_settime(wheel.timerFd, TFD_TIMER_ABSTIME, &value, NULL) < 0) {
+        Log_Debug("ERROR: Could not set the timer wheel: %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+    wheel.armedTick = next;
+}
+
+/// <summary>
+///     Moves the timers of a slot down to the levels their expiry now belongs to.
+/// </summary>
+static void CascadeSlot(int level, int slot)
+{
+    Timer *timer = wheel.slots[level][slot];
+    wheel.slots[level][slot] = NULL;
+    wheel.occupied[level] &= ~(1ull << slot);
+    while (timer != NULL) {
+        Timer *next = timer->next;
+        InsertTimer(timer);
+        timer = next;
+    }
+}
+
+/// <summary>
+///     Runs the timers of a level 0 slot, the ones expiring at wheel.now.
+/// </summary>
+static void RunSlot(int slot, uint64_t nowNs)
+{
+    // Detach the slot so that timers re-armed by the handlers land in a fresh list
+    Timer *expired = wheel.slots[0][slot];
+    wheel.slots[0][slot] = NULL;
+    wheel.occupied[0] &= ~(1ull << slot);
+    if (expired != NULL) {
+        expired->pprev = &expired;
+    }
+    while (expired != NULL) {
+        Timer *timer = expired;
+        UnlinkTimer(timer);
+        timer->armed = false;
+        if (timer->periodMs > 0) {
+            // Periodic timers keep their phase, unless they fell a whole period behind
+            timer->expiry += timer->periodMs;
+            if (timer->expiry <= wheel.now) {
+                timer->expiry = wheel.now + 1;
+            }
+            timer->armed = true;
+            InsertTimer(timer);
+        }
+        uint64_t dueNs = (uint64_t)wheel.start.tv_sec * 1000000000u +
+            (uint64_t)wheel.start.tv_nsec + wheel.now * 1000000u;
+        uint64_t lateNs = nowNs > dueNs ? nowNs - dueNs : 0;
+        uint64_t start = GetMonotonicNs();
+        timer->handler(timer);
+        UpdateHandlerStats(&timer->stats, GetMonotonicNs() - start, lateNs);
+    }
+}
+
+/// <summary>
+///     Advances the wheel up to a tick, cascading and running every slot on the way.
+///     Empty stretches are skipped.
+/// </summary>
+static void AdvanceTimerWheel(uint64_t target)
+{
+    uint64_t nowNs = GetMonotonicNs();
+    while (wheel.now < target) {
+        // Next tick with something to do: a level 0 slot, a cascade, or the target
+        uint64_t boundary = (wheel.now | TIMER_WHEEL_SLOT_MASK) + 1;
+        uint64_t next = boundary;
+        int slot = (int)(wheel.now & TIMER_WHEEL_SLOT_MASK);
+        uint64_t ahead = slot == TIMER_WHEEL_SLOT_MASK ? 0 : wheel.occupied[0] >> (slot + 1);
+        if (ahead != 0) {
+            next = wheel.now + (uint64_t)__builtin_ctzll(ahead) + 1;
+        }
+        if (next > target) {
+            next = target;
+        }
+        wheel.now = next;
+        if ((next & TIMER_WHEEL_SLOT_MASK) == 0) {
+            for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+                int index = (int)((next >> (TIMER_WHEEL_SLOT_BITS * level)) & TIMER_WHEEL_SLOT_MASK);
+                CascadeSlot(level, index);
+                if (index != 0) {
+                    break;
+                }
+            }
+        }
+        RunSlot((int)(next & TIMER_WHEEL_SLOT_MASK), nowNs);
+    }
+}
+
+static void TimerWheelEventHandler(EventData *eventData)
+{
+    // The timerfd is nonblocking, it reads nothing if it was re-armed after it fired
+    uint64_t expirations;
+    if (read(wheel.timerFd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) {
+        Log_Debug("ERROR: Could not read the timer wheel: %s (%d).\n", strerror(errno), errno);
+    }
+    wheel.armedTick = 0;
+    wheel.dispatching = true;
+    AdvanceTimerWheel(GetWheelTick());
+    wheel.dispatching = false;
+    RearmTimerWheel();
+}
+
+int CreateTimerWheel(int epollFd)
+{
+    clock_gettime(CLOCK_MONOTONIC, &wheel.start);
+    wheel.now = 0;
+    wheel.armedTick = 0;
+    wheel.eventData.eventHandler = &TimerWheelEventHandler;
+    static const struct timespec disarmed = {0, 0};
+    wheel.timerFd = CreateTimerFdAndAddToEpoll(epollFd, &disarmed, &wheel.eventData, EPOLLIN);
+    return wheel.timerFd < 0 ? -1 : 0;
+}
+
+void CloseTimerWheel(void)
+{
+    CloseFdAndPrintError(wheel.timerFd, "TimerWheel");
+    wheel.timerFd = -1;
+}
+
+void ArmTimer(Timer *timer, uint32_t delayMs, uint32_t periodMs)
+{
+    if (timer->armed) {
+        UnlinkTimer(timer);
+    }
+    // The tick is rounded up so that the timer never fires early. The wheel lags behind
+    // the clock between wakeups, its current slot was already run
+    timer->expiry = GetWheelTick() + delayMs + 1;
+    if (timer->expiry <= wheel.now) {
+        timer->expiry = wheel.now + 1;
+    }
+    timer->periodMs = periodMs;
+    timer->armed = true;
+    InsertTimer(timer);
+    if (!wheel.dispatching) {
+        RearmTimerWheel();
+    }
+}
+
+void CancelTimer(Timer *timer)
+{
+    if (!timer->armed) {
+        return;
+    }
+    UnlinkTimer(timer);
+    timer->armed = false;
+    // The timerfd may fire for nothing, the wheel is re-armed on the next wakeup
+}
+
+bool IsTimerArmed(const Timer *timer)
+{
+    return timer->armed;
+}
+
 void CloseFdAndPrintError(int fd, const char *fdName)
 {
     if (fd >= 0) {
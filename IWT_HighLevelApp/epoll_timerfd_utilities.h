@@ -2,10 +2,17 @@
    Licensed under the MIT License. */
 
 #pragma once
+#include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 #include <sys/epoll.h>
 #include <unistd.h>
 
+/// Ready events dispatched per epoll wakeup.
+#ifndef EPOLL_DISPATCH_MAX_EVENTS
+#define EPOLL_DISPATCH_MAX_EVENTS 8
+#endif
+
 /// Forward declaration of the data type passed to the handlers.
 struct EventData;
 
@@ -15,6 +22,42 @@ struct EventData;
 /// <param name="eventData">The provided event data</param>
 typedef void (*EventHandler)(struct EventData *eventData);
 
+/// <summary>
+///     Function signature for idle handlers. An idle handler performs a small, bounded
+///     amount of deferred work each time it is called.
+/// </summary>
+/// <returns>true if more idle work is pending, false otherwise</returns>
+typedef bool (*IdleHandler)(void);
+
+/// <summary>
+///     Run time accounting of an event handler, updated by the dispatcher.
+/// </summary>
+typedef struct EventHandlerStats {
+    /// <summary>Number of calls</summary>
+    uint32_t calls;
+    /// <summary>Total and longest time spent in the handler</summary>
+    uint64_t runTimeNs;
+    uint32_t maxRunTimeNs;
+    /// <summary>Total and longest time the event waited for the handlers dispatched
+    /// before it in the same wakeup</summary>
+    uint64_t delayNs;
+    uint32_t maxDelayNs;
+} EventHandlerStats;
+
+/// <summary>
+///     Event loop accounting, updated by the dispatcher.
+/// </summary>
+typedef struct EventLoopStats {
+    /// <summary>epoll_wait calls that returned events</summary>
+    uint32_t wakeups;
+    /// <summary>Events dispatched</summary>
+    uint32_t events;
+    /// <summary>Idle handler steps</summary>
+    uint32_t idleSteps;
+    /// <summary>Time spent dispatching, handlers included</summary>
+    uint64_t dispatchTimeNs;
+} EventLoopStats;
+
 /// <summary>
 /// <para>Contains context data for epoll events.</para>
 /// <para>When an event is registered with RegisterEventHandlerToEpoll, supply
@@ -31,6 +74,10 @@ typedef struct EventData {
     /// The file descriptor that generated the event.
     /// </summary>
     int fd;
+    /// <summary>
+    /// Run time accounting, zero initialized with the rest of the struct.
+    /// </summary>
+    EventHandlerStats stats;
 } EventData;
 
 /// <summary>
@@ -97,7 +144,9 @@ int CreateTimerFdAndAddToEpoll(int epollFd, const struct timespec *period,
                                EventData *persistentEventData, const uint32_t epollEventMask);
 
 /// <summary>
-///     Waits for an event on an epoll instance and triggers the handler.
+///     Waits for events on an epoll instance and triggers their handlers, up to
+///     EPOLL_DISPATCH_MAX_EVENTS per wakeup. A handler must not release the EventData
+///     of another registered event, it may still be dispatched in the same wakeup.
 /// </summary>
 /// <param name="epollFd">
 ///     Epoll file descriptor which was created with <see cref="CreateEpollFd" />.
@@ -105,6 +154,110 @@ int CreateTimerFdAndAddToEpoll(int epollFd, const struct timespec *period,
 /// <returns>0 on success, or -1 on failure</returns>
 int WaitForEventAndCallHandler(int epollFd);
 
+/// <summary>
+///     Waits for events on an epoll instance and triggers their handlers, up to
+///     EPOLL_DISPATCH_MAX_EVENTS per wakeup. While no event is ready and the idle handler
+///     reports pending work, the idle handler runs instead of blocking, so deferred work
+///     never delays an event by more than one idle step.
+/// </summary>
+/// <param name="epollFd">
+///     Epoll file descriptor which was created with <see cref="CreateEpollFd" />.
+/// </param>
+/// <param name="idleHandler">Handler for deferred work, may be NULL</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int WaitForEventOrRunIdleHandler(int epollFd, IdleHandler idleHandler);
+
+/// <summary>
+///     Logs the run time accounting of an event or timer handler and starts it over.
+/// </summary>
+/// <param name="stats">The stats of the handler, in its EventData or Timer</param>
+/// <param name="name">Handler name to use in the log</param>
+void LogEventHandlerStats(EventHandlerStats *stats, const char *name);
+
+/// <summary>
+///     Logs the event loop accounting and starts it over.
+/// </summary>
+void LogEventLoopStats(void);
+
+/// Timer wheel geometry: TIMER_WHEEL_LEVELS levels of 64 slots, the first one 1 ms per slot.
+/// Longer delays are fine, the timer is reinserted when it reaches the last level.
+#ifndef TIMER_WHEEL_LEVELS
+#define TIMER_WHEEL_LEVELS 4
+#endif
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+
+struct Timer;
+
+/// <summary>
+///     Function signature for timer handlers.
+/// </summary>
+/// <param name="timer">The timer that expired</param>
+typedef void (*TimerHandler)(struct Timer *timer);
+
+/// <summary>
+/// <para>A one-shot or periodic timer of the timer wheel.</para>
+/// <para>Only the handler and context fields are populated by the owner, the rest belongs to
+/// the wheel. The struct must stay in memory while the timer is armed.</para>
+/// </summary>
+/// <seealso cref="ArmTimer" />
+typedef struct Timer {
+    /// <summary>
+    /// Function which is called when the timer expires.
+    /// </summary>
+    TimerHandler handler;
+    /// <summary>
+    /// Owner of the timer, for the handler. Not used by the wheel.
+    /// </summary>
+    void *context;
+    /// <summary>
+    /// Run time accounting, the delay is the lateness of the handler.
+    /// </summary>
+    EventHandlerStats stats;
+    struct Timer *next;
+    struct Timer **pprev;
+    uint64_t expiry;
+    uint32_t periodMs;
+    uint8_t level;
+    uint8_t slot;
+    bool armed;
+} Timer;
+
+/// <summary>
+///     Creates the timer wheel: a single timerfd, added to the epoll instance, runs
+///     every Timer. Must be called before any timer is armed.
+/// </summary>
+/// <param name="epollFd">Epoll file descriptor</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int CreateTimerWheel(int epollFd);
+
+/// <summary>
+///     Closes the timerfd of the timer wheel. Armed timers never expire.
+/// </summary>
+void CloseTimerWheel(void);
+
+/// <summary>
+///     Arms a timer, or re-arms it if it is armed already. O(1), the timerfd is only
+///     touched if the timer expires before every other one.
+/// </summary>
+/// <param name="timer">The timer</param>
+/// <param name="delayMs">Time to the first expiry, in milliseconds</param>
+/// <param name="periodMs">Time between the next expiries, 0 for a one-shot timer</param>
+void ArmTimer(Timer *timer, uint32_t delayMs, uint32_t periodMs);
+
+/// <summary>
+///     Disarms a timer. O(1), harmless if the timer is not armed.
+/// </summary>
+/// <param name="timer">The timer</param>
+void CancelTimer(Timer *timer);
+
+/// <summary>
+///     Whether a timer is armed.
+/// </summary>
+/// <param name="timer">The timer</param>
+/// <returns>true if the timer will expire</returns>
+bool IsTimerArmed(const Timer *timer);
+
 /// <summary>
 ///     Closes a file descriptor and prints an error on failure.
 /// </summary>
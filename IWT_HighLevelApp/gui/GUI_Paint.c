@@ -45,6 +45,7 @@
 *
 ******************************************************************************/
 #include "GUI_Paint.h"
+#include "../qr/qrcodegen.h"
 
 #include <applibs/log.h>
 #include <stdint.h>
@@ -700,3 +701,91 @@ void Paint_DrawBitMap(const unsigned char* image_buffer)
         }
     }
 }
+
+/******************************************************************************
+function:	Fill pixels [Xstart, Xend) of one scanline of the image memory
+parameter:
+    Line   ：First byte of the scanline
+    Color  ：BLACK or WHITE
+******************************************************************************/
+static void Paint_FillSpan(UBYTE *Line, UWORD Xstart, UWORD Xend, UWORD Color)
+{
+    UBYTE Fill = (Color == BLACK) ? 0x00 : 0xFF;
+    UWORD First = Xstart / 8, Last = (Xend - 1) / 8;
+    UBYTE HeadMask = 0xFF >> (Xstart % 8);
+    UBYTE TailMask = 0xFF << (7 - (Xend - 1) % 8);
+
+    if (First == Last) {
+        HeadMask &= TailMask;
+        Line[First] = (Line[First] & ~HeadMask) | (Fill & HeadMask);
+        return;
+    }
+    Line[First] = (Line[First] & ~HeadMask) | (Fill & HeadMask);
+    memset(&Line[First + 1], Fill, Last - First - 1);
+    Line[Last] = (Line[Last] & ~TailMask) | (Fill & TailMask);
+}
+
+/******************************************************************************
+function:	Display a QR code
+parameter:
+    Xstart      ：X coordinate of the left edge of the first module
+    Ystart      ：Y coordinate of the top edge of the first module
+    qrcode      ：QR code matrix, as encoded by qrcodegen
+    Module_Size ：Width and height of a module, in pixels
+info:
+    Dark modules are BLACK and light modules WHITE, no quiet zone is drawn.
+    Without rotation or mirroring the first scanline of every module row is
+    written a byte at a time, merging modules of the same color, and the
+    other scanlines of the row are copies of it. Otherwise falls back to
+    Paint_SetPixel.
+******************************************************************************/
+void Paint_DrawQrCode(UWORD Xstart, UWORD Ystart, const UBYTE *qrcode, UWORD Module_Size)
+{
+    int Size = qrcodegen_getSize(qrcode);
+    UWORD Xend = Xstart + Size * Module_Size;
+    UWORD Yend = Ystart + Size * Module_Size;
+    if (Module_Size == 0 || Xend > Paint.Width || Yend > Paint.Height) {
+        Log_Debug("Paint_DrawQrCode Input exceeds the normal display range\r\n");
+        return;
+    }
+
+    if (Paint.Rotate != ROTATE_0 || Paint.Mirror != MIRROR_NONE) {
+        for (UWORD Y = Ystart; Y < Yend; Y++) {
+            for (UWORD X = Xstart; X < Xend; X++) {
+                bool Dark = qrcodegen_getModule(qrcode, (X - Xstart) / Module_Size, (Y - Ystart) / Module_Size);
+                Paint_SetPixel(X, Y, Dark ? BLACK : WHITE);
+            }
+        }
+        return;
+    }
+
+    // Bytes of a scanline that hold only QR pixels, and masks of the partial bytes at both ends
+    UWORD First = Xstart / 8, Last = (Xend - 1) / 8;
+    UBYTE HeadMask = 0xFF >> (Xstart % 8);
+    UBYTE TailMask = 0xFF << (7 - (Xend - 1) % 8);
+    if (First == Last) {
+        HeadMask &= TailMask;
+    }
+
+    for (int Row = 0; Row < Size; Row++) {
+        UBYTE *Line = &Paint.Image[(Ystart + Row * Module_Size) * Paint.WidthByte];
+        int Run = 0;
+        for (int Column = 1; Column <= Size; Column++) {
+            bool Dark = qrcodegen_getModule(qrcode, Run, Row);
+            if (Column < Size && qrcodegen_getModule(qrcode, Column, Row) == Dark) {
+                continue;
+            }
+            Paint_FillSpan(Line, Xstart + Run * Module_Size, Xstart + Column * Module_Size, Dark ? BLACK : WHITE);
+            Run = Column;
+        }
+
+        for (UWORD Copy = 1; Copy < Module_Size; Copy++) {
+            UBYTE *Dest = Line + Copy * Paint.WidthByte;
+            Dest[First] = (Dest[First] & ~HeadMask) | (Line[First] & HeadMask);
+            if (First != Last) {
+                memcpy(&Dest[First + 1], &Line[First + 1], Last - First - 1);
+                Dest[Last] = (Dest[Last] & ~TailMask) | (Line[Last] & TailMask);
+            }
+        }
+    }
+}
@@ -182,6 +182,7 @@ void Paint_DrawTime(UWORD Xstart, UWORD Ystart, PAINT_TIME *pTime, sFONT* Font,
 
 //pic
 void Paint_DrawBitMap(const unsigned char* image_buffer);
+void Paint_DrawQrCode(UWORD Xstart, UWORD Ystart, const UBYTE *qrcode, UWORD Module_Size);
 
 
 #endif
@@ -188,24 +188,79 @@ int iwt_Base64encode(char* encoded, const char* string, int len)
 	return p - encoded;
 }
 
-void jwt_urlsafe_base64_encode(char* result, const char* str, const size_t len)
-{	   
-	// base64 encode
-	iwt_Base64encode(result, str, len);
-	// conver it as url safe.
-	int i, t;
-	for (i = t = 0; i < strlen(result); i++) {
-		switch (result[i]) {
-		case '+':
-			result[t] = '-';
-			break;
-		case '/':
-			result[t] = '_';
-			break;
-		case '=':
-			continue;
+static const char basis_64url[] =
+"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+/* Streaming url-safe base64 encoder (RFC 4648 section 5, no padding).
+ * Input may arrive in chunks of any size; bytes that do not complete a
+ * 3 byte group are held in the encoder until the next update or finish.
+ */
+void iwt_base64url_begin(iwt_base64url_encoder_t* encoder, char* out)
+{
+	encoder->out = out;
+	encoder->pendingLength = 0;
+}
+
+size_t iwt_base64url_update(iwt_base64url_encoder_t* encoder, const unsigned char* data, size_t len)
+{
+	char* p = encoder->out;
+	const unsigned char* end = data + len;
+
+	/* complete a group left over from the previous chunk */
+	while (encoder->pendingLength != 0 && data < end) {
+		encoder->pending[encoder->pendingLength++] = *data++;
+		if (encoder->pendingLength == 3) {
+			const unsigned char* in = encoder->pending;
+			*p++ = basis_64url[in[0] >> 2];
+			*p++ = basis_64url[((in[0] & 0x3) << 4) | (in[1] >> 4)];
+			*p++ = basis_64url[((in[1] & 0xF) << 2) | (in[2] >> 6)];
+			*p++ = basis_64url[in[2] & 0x3F];
+			encoder->pendingLength = 0;
 		}
-		t++;
 	}
-	result[t] = '\0';
-}
\ No newline at end of file
+
+	for (; end - data >= 3; data += 3) {
+		*p++ = basis_64url[data[0] >> 2];
+		*p++ = basis_64url[((data[0] & 0x3) << 4) | (data[1] >> 4)];
+		*p++ = basis_64url[((data[1] & 0xF) << 2) | (data[2] >> 6)];
+		*p++ = basis_64url[data[2] & 0x3F];
+	}
+
+	while (data < end) {
+		encoder->pending[encoder->pendingLength++] = *data++;
+	}
+
+	size_t written = (size_t)(p - encoder->out);
+	encoder->out = p;
+	return written;
+}
+
+size_t iwt_base64url_finish(iwt_base64url_encoder_t* encoder)
+{
+	char* p = encoder->out;
+	const unsigned char* in = encoder->pending;
+
+	if (encoder->pendingLength == 1) {
+		*p++ = basis_64url[in[0] >> 2];
+		*p++ = basis_64url[(in[0] & 0x3) << 4];
+	}
+	else if (encoder->pendingLength == 2) {
+		*p++ = basis_64url[in[0] >> 2];
+		*p++ = basis_64url[((in[0] & 0x3) << 4) | (in[1] >> 4)];
+		*p++ = basis_64url[(in[1] & 0xF) << 2];
+	}
+	*p = '\0';
+	encoder->pendingLength = 0;
+
+	size_t written = (size_t)(p - encoder->out);
+	encoder->out = p;
+	return written;
+}
+
+void jwt_urlsafe_base64_encode(char* result, const char* str, const size_t len)
+{
+	iwt_base64url_encoder_t encoder;
+	iwt_base64url_begin(&encoder, result);
+	iwt_base64url_update(&encoder, (const unsigned char*)str, len);
+	iwt_base64url_finish(&encoder);
+}
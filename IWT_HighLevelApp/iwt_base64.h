@@ -3,6 +3,18 @@
 #include <string.h>
 #ifndef _JWT_BASE64_H_
 #define _JWT_BASE64_H_
+
+/* State of a streaming url-safe base64 encoder */
+typedef struct {
+	char* out;
+	unsigned char pending[3];
+	unsigned char pendingLength;
+} iwt_base64url_encoder_t;
+
+void iwt_base64url_begin(iwt_base64url_encoder_t* encoder, char* out);
+size_t iwt_base64url_update(iwt_base64url_encoder_t* encoder, const unsigned char* data, size_t len);
+size_t iwt_base64url_finish(iwt_base64url_encoder_t* encoder);
+
 void jwt_urlsafe_base64_encode(char* result, const char* str, size_t len);
 #endif /* _JWT_BASE64_H_ */
 
@@ -7,27 +7,121 @@ static WOLFSSL_HEAP_HINT* HEAP_HINT;
 #endif /* WOLFSSL_STATIC_MEMORY */
 static int devId = INVALID_DEVID;
 
-int iwt_crypto_hmacsha256(uint8_t* hmacDigest,
+// Zero key material. Stores through a volatile pointer are not dropped as dead
+// stores, like wolfSSL's ForceZero, which the SDK library does not export.
+static void iwt_crypto_zero(void* buffer, size_t size) {
+	volatile uint8_t* p = (volatile uint8_t*)buffer;
+	while (size--) {
+		*p++ = 0;
+	}
+}
+
+// Precompute the inner and outer HMAC midstates for key. Keys longer than
+// the SHA-256 block are hashed first, as RFC 2104 requires.
+int iwt_crypto_signer_init(iwt_hmac_signer_t* signer,
+	const uint8_t* key,
+	const uint32_t key_size) {
+	uint8_t keyBlock[WC_SHA256_BLOCK_SIZE];
+	uint8_t pad[WC_SHA256_BLOCK_SIZE];
+	int ret = 0;
+
+	XMEMSET(keyBlock, 0, sizeof(keyBlock));
+	if (key_size > WC_SHA256_BLOCK_SIZE) {
+		if (wc_InitSha256_ex(&signer->innerState, HEAP_HINT, devId) != 0
+			|| wc_Sha256Update(&signer->innerState, (const byte*)key, (word32)key_size) != 0
+			|| wc_Sha256Final(&signer->innerState, keyBlock) != 0) {
+			ret = -3540;
+		}
+	}
+	else {
+		XMEMCPY(keyBlock, key, key_size);
+	}
+
+	if (ret == 0) {
+		for (int i = 0; i < WC_SHA256_BLOCK_SIZE; i++) {
+			pad[i] = keyBlock[i] ^ 0x36;
+		}
+		if (wc_InitSha256_ex(&signer->innerState, HEAP_HINT, devId) != 0
+			|| wc_Sha256Update(&signer->innerState, pad, WC_SHA256_BLOCK_SIZE) != 0) {
+			ret = -3550;
+		}
+	}
+	if (ret == 0) {
+		for (int i = 0; i < WC_SHA256_BLOCK_SIZE; i++) {
+			pad[i] = keyBlock[i] ^ 0x5c;
+		}
+		if (wc_InitSha256_ex(&signer->outerState, HEAP_HINT, devId) != 0
+			|| wc_Sha256Update(&signer->outerState, pad, WC_SHA256_BLOCK_SIZE) != 0) {
+			ret = -3560;
+		}
+	}
+
+	iwt_crypto_zero(keyBlock, sizeof(keyBlock));
+	iwt_crypto_zero(pad, sizeof(pad));
+	return ret;
+}
+
+// Start an HMAC-SHA256 computation from the cached inner midstate.
+int iwt_crypto_stream_begin(iwt_hmac_signer_t* signer, iwt_hmac_stream_t* stream) {
+	if (wc_Sha256Copy(&signer->innerState, &stream->sha) != 0)
+		return -3570;
+	return 0;
+}
+
+// Duplicate a computation in progress, to reuse a common message prefix.
+int iwt_crypto_stream_copy(iwt_hmac_stream_t* source, iwt_hmac_stream_t* destination) {
+	if (wc_Sha256Copy(&source->sha, &destination->sha) != 0)
+		return -3570;
+	return 0;
+}
+
+// Zero a computation that will not be finished. Its state is derived from the key.
+void iwt_crypto_stream_wipe(iwt_hmac_stream_t* stream) {
+	iwt_crypto_zero(stream, sizeof(*stream));
+}
+
+int iwt_crypto_stream_update(iwt_hmac_stream_t* stream,
 	const uint8_t* input,
-	const uint32_t input_size,
-	const uint8_t* key ) {
-	Hmac        hmac;
-	int ret;
-	if (wc_HmacInit(&hmac, HEAP_HINT, devId) != 0)
-		return -3500;
-
-	ret = wc_HmacSetKey(&hmac, WC_SHA256, (byte*)key,
-		(word32)XSTRLEN(key));
-	if (ret != 0)
-		return -3510;
-	
-		ret = wc_HmacUpdate(&hmac, (byte*)input,
-			(word32)input_size);
-	if (ret != 0)
-		return -3520;
-	ret = wc_HmacFinal(&hmac, hmacDigest);
-	if (ret != 0)
-		return -3530;
+	const uint32_t input_size) {
+	if (wc_Sha256Update(&stream->sha, (const byte*)input, (word32)input_size) != 0)
+		return -3580;
 	return 0;
 }
 
+// Finish the inner hash and run the outer hash from the cached outer midstate.
+// The stream is wiped, also on failure.
+int iwt_crypto_stream_final(iwt_hmac_signer_t* signer,
+	iwt_hmac_stream_t* stream,
+	uint8_t* hmacDigest) {
+	uint8_t innerDigest[WC_SHA256_DIGEST_SIZE];
+	int ret = 0;
+
+	if (wc_Sha256Final(&stream->sha, innerDigest) != 0)
+		ret = -3580;
+	else if (wc_Sha256Copy(&signer->outerState, &stream->sha) != 0)
+		ret = -3570;
+	else if (wc_Sha256Update(&stream->sha, innerDigest, WC_SHA256_DIGEST_SIZE) != 0
+		|| wc_Sha256Final(&stream->sha, hmacDigest) != 0)
+		ret = -3590;
+
+	iwt_crypto_zero(innerDigest, sizeof(innerDigest));
+	iwt_crypto_stream_wipe(stream);
+	return ret;
+}
+
+// HMAC-SHA256 of input with the signer key. The midstates are cloned,
+// only the message and the inner digest are hashed.
+int iwt_crypto_signer_sign(iwt_hmac_signer_t* signer,
+	uint8_t* hmacDigest,
+	const uint8_t* input,
+	const uint32_t input_size) {
+	iwt_hmac_stream_t stream;
+	int ret = iwt_crypto_stream_begin(signer, &stream);
+	if (ret == 0)
+		ret = iwt_crypto_stream_update(&stream, input, input_size);
+	if (ret == 0)
+		ret = iwt_crypto_stream_final(signer, &stream, hmacDigest);
+	else
+		iwt_crypto_stream_wipe(&stream);
+	return ret;
+}
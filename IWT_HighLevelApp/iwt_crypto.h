@@ -3,6 +3,23 @@
 #include <stdint.h>
 #include "user_settings.h"
 #include "wolfssl/wolfcrypt/sha256.h"
-#include "wolfssl/wolfcrypt/hmac.h"
 
-int iwt_crypto_hmacsha256(uint8_t* hmacDigest,	const uint8_t* buffer,	const uint32_t src_buf_size, const uint8_t* key);
+// HMAC-SHA256 signer for a fixed key. Holds the SHA-256 states after hashing the
+// inner and outer padded key blocks, so each signature only hashes the message.
+typedef struct {
+	wc_Sha256 innerState;
+	wc_Sha256 outerState;
+} iwt_hmac_signer_t;
+
+// HMAC-SHA256 computation in progress, fed incrementally.
+typedef struct {
+	wc_Sha256 sha;
+} iwt_hmac_stream_t;
+
+int iwt_crypto_signer_init(iwt_hmac_signer_t* signer, const uint8_t* key, const uint32_t key_size);
+int iwt_crypto_signer_sign(iwt_hmac_signer_t* signer, uint8_t* hmacDigest, const uint8_t* input, const uint32_t input_size);
+int iwt_crypto_stream_begin(iwt_hmac_signer_t* signer, iwt_hmac_stream_t* stream);
+int iwt_crypto_stream_copy(iwt_hmac_stream_t* source, iwt_hmac_stream_t* destination);
+void iwt_crypto_stream_wipe(iwt_hmac_stream_t* stream);
+int iwt_crypto_stream_update(iwt_hmac_stream_t* stream, const uint8_t* input, const uint32_t input_size);
+int iwt_crypto_stream_final(iwt_hmac_signer_t* signer, iwt_hmac_stream_t* stream, uint8_t* hmacDigest);
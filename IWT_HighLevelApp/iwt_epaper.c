@@ -0,0 +1,266 @@
+/* Enrique Albertos.
+   Licensed under the MIT License. */
+
+// Full and partial refresh of the e-paper panel.
+//
+// The controller RAM has two banks: the one written by WRITE_RAM and the one shown before the
+// last refresh, which the partial waveform uses as the old image. Every refresh swaps them, so
+// after each refresh the new frame is written again to keep both banks equal.
+//
+// Deep sleep keeps the RAM and loses the registers: waking the panel up takes a hardware reset
+// and EPD_Init, the frame in RAM survives. The panel is left awake for IWT_EPAPER_SLEEP_DELAY_MS
+// after a refresh, so that screens shown back to back only switch the LUT when the waveform
+// changes.
+//
+// A refresh takes up to two seconds. It is started and left running: a timer of the epoll
+// loop wheel polls the BUSY pin, and when the panel is idle again the banks are synced, the same
+// timer is armed to put the panel to sleep and the refreshed callback runs. The render
+// scheduler keeps the screen asked for meanwhile and shows it from the callback.
+
+#include <string.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+#include "iwt_epaper.h"
+
+#define EPAPER_ROW_BYTES (IWT_EPAPER_FRAME_SIZE / EPD_HEIGHT)
+
+static void TimerExpiredHandler(Timer* timer);
+
+/// <summary>
+///     Initialize the session, its timer disarmed. The timer wheel must be created. The panel
+///     is considered asleep and the first refresh is a full one. refreshed may be NULL.
+/// </summary>
+/// <returns>0 on success</returns>
+int iwt_epaper_init(iwt_epaper_t* epaper, const SpiMasterConfigType* spiConfig, int partialRefreshMax,
+	iwt_epaper_refreshed_t refreshed) {
+	memset(epaper, 0, sizeof(*epaper));
+	epaper->spiConfig = spiConfig;
+	epaper->partialRefreshMax = partialRefreshMax;
+	epaper->refreshed = refreshed;
+	epaper->asleep = true;
+	epaper->timer.handler = &TimerExpiredHandler;
+	epaper->timer.context = epaper;
+	return 0;
+}
+
+/// <summary>
+///     Wait for the refresh in progress, put the panel to sleep and close the timer.
+/// </summary>
+void iwt_epaper_close(iwt_epaper_t* epaper) {
+	if (epaper->refreshing) {
+		EPD_WaitUntilIdle();
+		epaper->refreshing = false;
+	}
+	if (!epaper->asleep) {
+		EPD_Sleep();
+		epaper->asleep = true;
+	}
+	CancelTimer(&epaper->timer);
+}
+
+/// <summary>
+///     The frame buffer screens are painted on, one bit per pixel. It may be painted
+///     while a refresh is in progress and passed to iwt_epaper_display.
+/// </summary>
+UBYTE* iwt_epaper_canvas(iwt_epaper_t* epaper) {
+	return epaper->canvas;
+}
+
+/// <summary>
+///     Whether a refresh is in progress.
+/// </summary>
+bool iwt_epaper_busy(const iwt_epaper_t* epaper) {
+	return epaper->refreshing;
+}
+
+/// <summary>
+///     Force the next refresh to be a full one, e.g. when the panel content is unknown.
+/// </summary>
+void iwt_epaper_invalidate(iwt_epaper_t* epaper) {
+	epaper->previousValid = false;
+}
+
+/// <summary>
+///     Find the smallest window, in whole bytes, holding every difference between two frames.
+/// </summary>
+/// <returns>false if the frames are equal</returns>
+static bool findChangedWindow(const UBYTE* previous, const UBYTE* frame,
+	UWORD* firstByte, UWORD* firstRow, UWORD* lastByte, UWORD* lastRow) {
+	int top = -1, bottom = -1, left = EPAPER_ROW_BYTES, right = -1;
+	for (int row = 0; row < EPD_HEIGHT; row++) {
+		const UBYTE* a = &previous[row * EPAPER_ROW_BYTES];
+		const UBYTE* b = &frame[row * EPAPER_ROW_BYTES];
+		if (memcmp(a, b, EPAPER_ROW_BYTES) == 0) {
+			continue;
+		}
+		if (top < 0) {
+			top = row;
+		}
+		bottom = row;
+		for (int i = 0; i < left; i++) {
+			if (a[i] != b[i]) {
+				left = i;
+				break;
+			}
+		}
+		for (int i = EPAPER_ROW_BYTES - 1; i > right; i--) {
+			if (a[i] != b[i]) {
+				right = i;
+				break;
+			}
+		}
+	}
+	if (top < 0) {
+		return false;
+	}
+	*firstByte = (UWORD)left;
+	*lastByte = (UWORD)right;
+	*firstRow = (UWORD)top;
+	*lastRow = (UWORD)bottom;
+	return true;
+}
+
+/// <summary>
+///     Put the panel to deep sleep. The next refresh wakes it up with EPD_Init.
+/// </summary>
+static void sleepPanel(iwt_epaper_t* epaper) {
+	EPD_Sleep();
+	epaper->asleep = true;
+	epaper->lut = NULL;
+}
+
+/// <summary>
+///     Wake the panel up if it sleeps and load the waveform if it is not loaded yet.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+static int preparePanel(iwt_epaper_t* epaper, const unsigned char* lut) {
+	if (epaper->asleep) {
+		if (EPD_Init(lut, epaper->spiConfig) != 0) {
+			return -1;
+		}
+		epaper->asleep = false;
+	} else if (epaper->lut != lut) {
+		EPD_SetLut(lut);
+	}
+	epaper->lut = lut;
+	return 0;
+}
+
+/// <summary>
+///     Upload the window that changed and start the refresh, without waiting for it.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+static int startRefresh(iwt_epaper_t* epaper, const UBYTE* frame) {
+	bool partial = epaper->previousValid && epaper->partialRefreshCount < epaper->partialRefreshMax;
+	UWORD firstByte = 0, firstRow = 0;
+	UWORD lastByte = EPAPER_ROW_BYTES - 1, lastRow = EPD_HEIGHT - 1;
+	if (epaper->previousValid && !findChangedWindow(epaper->previous, frame, &firstByte, &firstRow, &lastByte, &lastRow)) {
+		return 0;
+	}
+	if (!partial) {
+		firstByte = 0;
+		firstRow = 0;
+		lastByte = EPAPER_ROW_BYTES - 1;
+		lastRow = EPD_HEIGHT - 1;
+	}
+
+	const unsigned char* lut = partial ? LUT_PARTIAL_UPDATE() : LUT_FULL_UPDATE();
+	if (preparePanel(epaper, lut) != 0) {
+		Log_Debug("ERROR: e-Paper init failed\n");
+		epaper->previousValid = false;
+		return -1;
+	}
+	epaper->xStart = firstByte * 8;
+	epaper->xEnd = lastByte * 8 + 7;
+	epaper->yStart = firstRow;
+	epaper->yEnd = lastRow;
+	EPD_WriteWindow(frame, epaper->xStart, epaper->yStart, epaper->xEnd, epaper->yEnd);
+	EPD_StartDisplay();
+
+	// previous holds the frame being shown from now on, it is valid once the refresh is over
+	memcpy(epaper->previous, frame, IWT_EPAPER_FRAME_SIZE);
+	epaper->previousValid = false;
+	epaper->partial = partial;
+	epaper->refreshing = true;
+	clock_gettime(CLOCK_MONOTONIC, &epaper->refreshStart);
+	ArmTimer(&epaper->timer, IWT_EPAPER_BUSY_POLL_MS, IWT_EPAPER_BUSY_POLL_MS);
+	return 0;
+}
+
+/// <summary>
+///     The panel is idle again: sync the banks, arm the sleep timer and report the refresh. A failed refresh leaves BUSY high and
+///     the panel takes no command: it is only marked asleep, so that the next refresh starts
+///     from the hardware reset of EPD_Init.
+/// </summary>
+static void finishRefresh(iwt_epaper_t* epaper, int result) {
+	epaper->refreshing = false;
+	if (result == 0) {
+		// The banks swapped, bring the other one up to date
+		EPD_WriteWindow(epaper->previous, epaper->xStart, epaper->yStart, epaper->xEnd, epaper->yEnd);
+		if (epaper->partial) {
+			epaper->partialRefreshCount++;
+		} else {
+			epaper->partialRefreshCount = 0;
+		}
+		epaper->previousValid = true;
+		Log_Debug("e-Paper %s refresh, window %d,%d %d,%d\n", epaper->partial ? "partial" : "full",
+			epaper->xStart, epaper->yStart, epaper->xEnd, epaper->yEnd);
+	} else {
+		epaper->asleep = true;
+		epaper->lut = NULL;
+	}
+
+	if (epaper->asleep) {
+		CancelTimer(&epaper->timer);
+	} else {
+		ArmTimer(&epaper->timer, IWT_EPAPER_SLEEP_DELAY_MS, 0);
+	}
+	if (epaper->refreshed != NULL) {
+		epaper->refreshed(result);
+	}
+}
+
+/// <summary>
+///     Session timer: while refreshing it polls BUSY and finishes the refresh once the pin
+///     goes low, otherwise it is the sleep delay.
+/// </summary>
+static void TimerExpiredHandler(Timer* timer) {
+	iwt_epaper_t* epaper = timer->context;
+	if (!epaper->refreshing) {
+		if (!epaper->asleep) {
+			sleepPanel(epaper);
+		}
+		return;
+	}
+	if (EPD_IsBusy()) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long elapsedMs = (now.tv_sec - epaper->refreshStart.tv_sec) * 1000 +
+			(now.tv_nsec - epaper->refreshStart.tv_nsec) / 1000000;
+		if (elapsedMs < IWT_EPAPER_REFRESH_TIMEOUT_MS) {
+			return;
+		}
+		Log_Debug("ERROR: e-Paper still busy after %ld ms\n", elapsedMs);
+		finishRefresh(epaper, -1);
+		return;
+	}
+	finishRefresh(epaper, 0);
+}
+
+/// <summary>
+///     Show a frame. Only the window that changed since the previous frame is uploaded and
+///     refreshed with the partial waveform, until partialRefreshMax partial refreshes in a row
+///     call for a full refresh. Nothing is done if the frame is already on the panel.
+///     Returns as soon as the refresh is started, the refreshed callback tells when it is over.
+///     The panel must not be busy, see iwt_epaper_busy.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+int iwt_epaper_display(iwt_epaper_t* epaper, const UBYTE* frame) {
+	if (epaper->refreshing) {
+		Log_Debug("ERROR: e-Paper busy, frame dropped\n");
+		return -1;
+	}
+	return startRefresh(epaper, frame);
+}
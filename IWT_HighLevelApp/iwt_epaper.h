@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdbool.h>
+#include <time.h>
+#include "epoll_timerfd_utilities.h"
+#include "epd/EPD_1in54.h"
+
+// Bytes of a whole frame, one bit per pixel
+#define IWT_EPAPER_FRAME_SIZE (((EPD_WIDTH % 8 == 0) ? (EPD_WIDTH / 8) : (EPD_WIDTH / 8 + 1)) * EPD_HEIGHT)
+
+// Partial refreshes in a row before a full refresh clears the ghosting
+#ifndef IWT_EPAPER_PARTIAL_REFRESH_MAX
+#define IWT_EPAPER_PARTIAL_REFRESH_MAX 8
+#endif
+// Period of the BUSY pin poll while the panel refreshes
+#ifndef IWT_EPAPER_BUSY_POLL_MS
+#define IWT_EPAPER_BUSY_POLL_MS 20
+#endif
+// A refresh still busy after this long has failed
+#ifndef IWT_EPAPER_REFRESH_TIMEOUT_MS
+#define IWT_EPAPER_REFRESH_TIMEOUT_MS 5000
+#endif
+// The panel stays awake this long after a refresh, a screen shown meanwhile needs no wake-up
+#ifndef IWT_EPAPER_SLEEP_DELAY_MS
+#define IWT_EPAPER_SLEEP_DELAY_MS 10000
+#endif
+
+/// <summary>
+///     Called from the epoll loop when a refresh is over.
+/// </summary>
+/// <param name="result">0 on success, or -1 on failure</param>
+typedef void (*iwt_epaper_refreshed_t)(int result);
+
+/// <summary>
+///     E-paper display session: whether the panel sleeps and the waveform it is programmed
+///     with, the canvas screens are painted on, the frame on the panel, kept to find what
+///     changed, the number of partial refreshes since the last full one, and the refresh
+///     in progress.
+/// </summary>
+typedef struct {
+	Timer timer;
+	iwt_epaper_refreshed_t refreshed;
+	const SpiMasterConfigType* spiConfig;
+	bool asleep;
+	const unsigned char* lut;
+	int partialRefreshMax;
+	int partialRefreshCount;
+	bool previousValid;
+	// Refresh in progress and its window
+	bool refreshing;
+	bool partial;
+	struct timespec refreshStart;
+	UWORD xStart, yStart, xEnd, yEnd;
+	UBYTE previous[IWT_EPAPER_FRAME_SIZE];
+	UBYTE canvas[IWT_EPAPER_FRAME_SIZE];
+} iwt_epaper_t;
+
+int iwt_epaper_init(iwt_epaper_t* epaper, const SpiMasterConfigType* spiConfig, int partialRefreshMax,
+	iwt_epaper_refreshed_t refreshed);
+UBYTE* iwt_epaper_canvas(iwt_epaper_t* epaper);
+int iwt_epaper_display(iwt_epaper_t* epaper, const UBYTE* frame);
+bool iwt_epaper_busy(const iwt_epaper_t* epaper);
+void iwt_epaper_invalidate(iwt_epaper_t* epaper);
+void iwt_epaper_close(iwt_epaper_t* epaper);
@@ -0,0 +1,221 @@
+/* Enrique Albertos.
+   Licensed under the MIT License. */
+
+// Bin fill level estimator.
+//
+// Proximity counts go into a ring of the last IWT_FILL_LEVEL_RING_SIZE samples. The median of
+// the ring drops single wrong readings, a hand over the sensor or a bag falling in, and a
+// moving average of the medians smooths what is left. The average is turned into a percent
+// with the calibration counts of the empty and the full bin, and the percent into a level.
+// A level only moves when the percent goes IWT_FILL_LEVEL_HYSTERESIS_PCT past its edge, so a
+// reading sitting on an edge does not toggle the display and the telemetry.
+//
+// The sample timer runs fast for two rings of samples after a wake up, the proximity service
+// wakes the estimator when the sensor raises its interrupt, and slow the rest of the time.
+// iwt_fill_level_window gives the proximity window of the current level, so the interrupt
+// follows the calibration.
+// Readers get the last estimate, no I2C transaction.
+
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "iwt_fill_level.h"
+#include "vcnl4040.h"
+
+static void TimerExpiredHandler(Timer* timer);
+
+/// <summary>
+///     Level of a fill percent, rounded to the nearest.
+/// </summary>
+static int levelForPercent(int percent) {
+	int level = (percent * IWT_FILL_LEVEL_MAX + 50) / 100;
+	if (level < 0) {
+		return 0;
+	}
+	return level > IWT_FILL_LEVEL_MAX ? IWT_FILL_LEVEL_MAX : level;
+}
+
+/// <summary>
+///     Median of the samples in the ring.
+/// </summary>
+static uint16_t median(const iwt_fill_level_t* fill) {
+	uint16_t sorted[IWT_FILL_LEVEL_RING_SIZE];
+	unsigned int n = fill->samples;
+	for (unsigned int i = 0; i < n; i++) {
+		uint16_t sample = fill->ring[i];
+		unsigned int j = i;
+		for (; j > 0 && sorted[j - 1] > sample; j--) {
+			sorted[j] = sorted[j - 1];
+		}
+		sorted[j] = sample;
+	}
+	if (n % 2 == 1) {
+		return sorted[n / 2];
+	}
+	return (uint16_t)((sorted[n / 2 - 1] + sorted[n / 2] + 1) / 2);
+}
+
+/// <summary>
+///     Fill percent of the moving average with the current calibration.
+/// </summary>
+static int percentForAverage(const iwt_fill_level_t* fill) {
+	int count = (int)((fill->average + 128) >> 8);
+	int percent = (fill->emptyCount - count) * 100 / (fill->emptyCount - fill->fullCount);
+	if (percent < 0) {
+		return 0;
+	}
+	return percent > 100 ? 100 : percent;
+}
+
+/// <summary>
+///     Proximity count of a fill percent with the current calibration.
+/// </summary>
+static int countForPercent(const iwt_fill_level_t* fill, int percent) {
+	return fill->emptyCount - percent * (fill->emptyCount - fill->fullCount) / 100;
+}
+
+/// <summary>
+///     Set the estimate and report a new level.
+/// </summary>
+static void setLevel(iwt_fill_level_t* fill, int level) {
+	if (level != fill->level) {
+		fill->level = level;
+		if (fill->changed != NULL) {
+			fill->changed(level, fill->percent);
+		}
+	}
+}
+
+/// <summary>
+///     Initialize the estimator with the default calibration, take the first sample and arm
+///     the sample timer. The sensor must be started with vcnl4040_begin and the timer wheel
+///     created. The first level is not reported.
+/// </summary>
+/// <returns>0 on success</returns>
+int iwt_fill_level_init(iwt_fill_level_t* fill, iwt_fill_level_changed_t changed) {
+	memset(fill, 0, sizeof(*fill));
+	fill->timer.handler = &TimerExpiredHandler;
+	fill->timer.context = fill;
+	fill->emptyCount = IWT_FILL_LEVEL_EMPTY_COUNT;
+	fill->fullCount = IWT_FILL_LEVEL_FULL_COUNT;
+	iwt_fill_level_add_sample(fill, vcnl4040_getProximity());
+	fill->changed = changed;
+	iwt_fill_level_wake(fill);
+	return 0;
+}
+
+/// <summary>
+///     Set the proximity counts of the empty and the full bin. The current estimate is
+///     recomputed with them at once, without hysteresis.
+/// </summary>
+/// <returns>0 on success, -1 if the counts are not a usable calibration</returns>
+int iwt_fill_level_calibrate(iwt_fill_level_t* fill, int emptyCount, int fullCount) {
+	if (emptyCount < 0 || emptyCount > UINT16_MAX || fullCount < 0 || fullCount > UINT16_MAX || emptyCount == fullCount) {
+		Log_Debug("ERROR: Invalid fill level calibration, empty %d full %d.\n", emptyCount, fullCount);
+		return -1;
+	}
+	if (emptyCount == fill->emptyCount && fullCount == fill->fullCount) {
+		return 0;
+	}
+	fill->emptyCount = (uint16_t)emptyCount;
+	fill->fullCount = (uint16_t)fullCount;
+	Log_Debug("Fill level calibration: empty %d, full %d.\n", emptyCount, fullCount);
+	if (fill->samples > 0) {
+		fill->percent = percentForAverage(fill);
+		setLevel(fill, levelForPercent(fill->percent));
+	}
+	return 0;
+}
+
+/// <summary>
+///     The level may be moving: sample fast for two rings of samples.
+/// </summary>
+void iwt_fill_level_wake(iwt_fill_level_t* fill) {
+	if (fill->fastSamplesLeft == 0) {
+		ArmTimer(&fill->timer, IWT_FILL_LEVEL_FAST_SAMPLE_MS, IWT_FILL_LEVEL_FAST_SAMPLE_MS);
+	}
+	fill->fastSamplesLeft = 2 * IWT_FILL_LEVEL_RING_SIZE;
+}
+
+/// <summary>
+///     Add a proximity count to the ring and update the estimate.
+/// </summary>
+void iwt_fill_level_add_sample(iwt_fill_level_t* fill, uint16_t count) {
+	fill->ring[fill->head] = count;
+	fill->head = (fill->head + 1) % IWT_FILL_LEVEL_RING_SIZE;
+	if (fill->samples < IWT_FILL_LEVEL_RING_SIZE) {
+		fill->samples++;
+	}
+	int32_t filtered = (int32_t)median(fill) << 8;
+	if (fill->samples == 1) {
+		fill->average = filtered;
+	} else {
+		fill->average += (filtered - fill->average) >> IWT_FILL_LEVEL_EMA_SHIFT;
+	}
+	fill->percent = percentForAverage(fill);
+
+	if (fill->samples == 1) {
+		fill->level = levelForPercent(fill->percent);
+		return;
+	}
+	int up = levelForPercent(fill->percent - IWT_FILL_LEVEL_HYSTERESIS_PCT);
+	int down = levelForPercent(fill->percent + IWT_FILL_LEVEL_HYSTERESIS_PCT);
+	if (up > fill->level) {
+		setLevel(fill, up);
+	} else if (down < fill->level) {
+		setLevel(fill, down);
+	}
+}
+
+/// <summary>
+///     Last estimated fill level. No I2C transaction.
+/// </summary>
+int iwt_fill_level_level(const iwt_fill_level_t* fill) {
+	return fill->level;
+}
+
+/// <summary>
+///     Last estimated fill, 0 to 100 percent. No I2C transaction.
+/// </summary>
+int iwt_fill_level_percent(const iwt_fill_level_t* fill) {
+	return fill->percent;
+}
+
+/// <summary>
+///     Proximity counts the current level holds between with the current calibration: the
+///     percent band of the level widened by the hysteresis, and by a count for the rounding.
+///     A count out of them may move the level. The empty and the full level are open ended.
+/// </summary>
+void iwt_fill_level_window(const iwt_fill_level_t* fill, uint16_t* low, uint16_t* high) {
+	// Open end of the empty and of the full side, counts fall as the bin fills when empty > full
+	int emptyEnd = fill->emptyCount > fill->fullCount ? UINT16_MAX : 0;
+	int fullEnd = fill->emptyCount > fill->fullCount ? 0 : UINT16_MAX;
+	int level = fill->level;
+	int emptySide = level == 0 ? emptyEnd
+		: countForPercent(fill, (100 * level - 50) / IWT_FILL_LEVEL_MAX - IWT_FILL_LEVEL_HYSTERESIS_PCT);
+	int fullSide = level == IWT_FILL_LEVEL_MAX ? fullEnd
+		: countForPercent(fill, (100 * level + 50) / IWT_FILL_LEVEL_MAX + IWT_FILL_LEVEL_HYSTERESIS_PCT);
+	int lowCount = (emptySide < fullSide ? emptySide : fullSide) - 1;
+	int highCount = (emptySide < fullSide ? fullSide : emptySide) + 1;
+	*low = (uint16_t)(lowCount < 0 ? 0 : lowCount);
+	*high = (uint16_t)(highCount > UINT16_MAX ? UINT16_MAX : highCount);
+}
+
+/// <summary>
+///     Cancel the sample timer.
+/// </summary>
+void iwt_fill_level_close(iwt_fill_level_t* fill) {
+	CancelTimer(&fill->timer);
+}
+
+/// <summary>
+///     Sample timer: read the sensor, back to the slow period after the fast samples.
+/// </summary>
+static void TimerExpiredHandler(Timer* timer) {
+	iwt_fill_level_t* fill = timer->context;
+	iwt_fill_level_add_sample(fill, vcnl4040_getProximity());
+	if (fill->fastSamplesLeft > 0 && --fill->fastSamplesLeft == 0) {
+		ArmTimer(&fill->timer, IWT_FILL_LEVEL_IDLE_SAMPLE_MS, IWT_FILL_LEVEL_IDLE_SAMPLE_MS);
+	}
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "epoll_timerfd_utilities.h"
+
+// Proximity samples kept for the median, a power of two
+#ifndef IWT_FILL_LEVEL_RING_SIZE
+#define IWT_FILL_LEVEL_RING_SIZE 8
+#endif
+// Sample period while the level may be moving, for two rings of samples after a wake up
+#ifndef IWT_FILL_LEVEL_FAST_SAMPLE_MS
+#define IWT_FILL_LEVEL_FAST_SAMPLE_MS 500
+#endif
+// Sample period while the bin is at rest
+#ifndef IWT_FILL_LEVEL_IDLE_SAMPLE_MS
+#define IWT_FILL_LEVEL_IDLE_SAMPLE_MS 30000
+#endif
+// Weight of a new median in the moving average, 1 / 2^shift
+#ifndef IWT_FILL_LEVEL_EMA_SHIFT
+#define IWT_FILL_LEVEL_EMA_SHIFT 2
+#endif
+// Percent the fill must go past a level edge before the level moves
+#ifndef IWT_FILL_LEVEL_HYSTERESIS_PCT
+#define IWT_FILL_LEVEL_HYSTERESIS_PCT 4
+#endif
+// Default calibration, proximity counts of the empty and the full bin
+#ifndef IWT_FILL_LEVEL_EMPTY_COUNT
+#define IWT_FILL_LEVEL_EMPTY_COUNT 200
+#endif
+#ifndef IWT_FILL_LEVEL_FULL_COUNT
+#define IWT_FILL_LEVEL_FULL_COUNT 1
+#endif
+// Bin fill levels, 0 (empty) to IWT_FILL_LEVEL_MAX (full)
+#define IWT_FILL_LEVEL_MAX 5
+
+/// <summary>
+///     Called from the epoll loop when the fill level changed.
+/// </summary>
+/// <param name="level">The new fill level</param>
+/// <param name="percent">The filtered fill, 0 to 100</param>
+typedef void (*iwt_fill_level_changed_t)(int level, int percent);
+
+/// <summary>
+///     Fill level estimator.
+/// </summary>
+typedef struct {
+	Timer timer;
+	iwt_fill_level_changed_t changed;
+	uint16_t ring[IWT_FILL_LEVEL_RING_SIZE];
+	unsigned int head;
+	unsigned int samples;	// Samples in the ring, up to IWT_FILL_LEVEL_RING_SIZE
+	unsigned int fastSamplesLeft;
+	int32_t average;	// Moving average of the medians, 8 fractional bits
+	uint16_t emptyCount;
+	uint16_t fullCount;
+	int percent;
+	int level;
+} iwt_fill_level_t;
+
+int iwt_fill_level_init(iwt_fill_level_t* fill, iwt_fill_level_changed_t changed);
+int iwt_fill_level_calibrate(iwt_fill_level_t* fill, int emptyCount, int fullCount);
+void iwt_fill_level_wake(iwt_fill_level_t* fill);
+void iwt_fill_level_add_sample(iwt_fill_level_t* fill, uint16_t count);
+int iwt_fill_level_level(const iwt_fill_level_t* fill);
+int iwt_fill_level_percent(const iwt_fill_level_t* fill);
+void iwt_fill_level_window(const iwt_fill_level_t* fill, uint16_t* low, uint16_t* high);
+void iwt_fill_level_close(iwt_fill_level_t* fill);
@@ -0,0 +1,66 @@
+/* Enrique Albertos.
+   Licensed under the MIT License. */
+
+// Rendered frames, keyed by a hash of everything a screen is painted from: screen id, fill
+// level, cloud messages, minute... A screen whose inputs did not change is not painted again.
+
+#include <string.h>
+
+#include "iwt_frame_cache.h"
+
+#define FNV_PRIME 16777619u
+
+/// <summary>
+///     Feed bytes to a 32 bit FNV-1a hash. Start from IWT_FRAME_CACHE_HASH_INIT.
+/// </summary>
+/// <returns>The updated hash</returns>
+uint32_t iwt_frame_cache_hash(uint32_t hash, const void* data, size_t length) {
+	const uint8_t* p = (const uint8_t*)data;
+	for (size_t i = 0; i < length; i++) {
+		hash = (hash ^ p[i]) * FNV_PRIME;
+	}
+	return hash;
+}
+
+/// <summary>
+///     Empty the cache.
+/// </summary>
+void iwt_frame_cache_init(iwt_frame_cache_t* cache) {
+	memset(cache, 0, sizeof(*cache));
+}
+
+/// <summary>
+///     Find the frame rendered for a key.
+/// </summary>
+/// <returns>The frame, or NULL if it is not cached</returns>
+const UBYTE* iwt_frame_cache_lookup(iwt_frame_cache_t* cache, uint32_t key) {
+	for (int i = 0; i < IWT_FRAME_CACHE_SIZE; i++) {
+		iwt_frame_cache_entry_t* entry = &cache->entries[i];
+		if (entry->valid && entry->key == key) {
+			entry->lastUse = ++cache->useCounter;
+			return entry->frame;
+		}
+	}
+	return NULL;
+}
+
+/// <summary>
+///     Keep a rendered frame, in place of the least recently used one.
+/// </summary>
+void iwt_frame_cache_store(iwt_frame_cache_t* cache, uint32_t key, const UBYTE* frame) {
+	iwt_frame_cache_entry_t* victim = &cache->entries[0];
+	for (int i = 0; i < IWT_FRAME_CACHE_SIZE; i++) {
+		iwt_frame_cache_entry_t* entry = &cache->entries[i];
+		if (!entry->valid || entry->key == key) {
+			victim = entry;
+			break;
+		}
+		if (entry->lastUse < victim->lastUse) {
+			victim = entry;
+		}
+	}
+	memcpy(victim->frame, frame, IWT_EPAPER_FRAME_SIZE);
+	victim->key = key;
+	victim->valid = true;
+	victim->lastUse = ++cache->useCounter;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "iwt_epaper.h"
+
+// Rendered frames kept, the least recently used one is replaced. A frame is 5000 bytes: one
+// entry keeps the idle screen that comes back after every QR code
+#ifndef IWT_FRAME_CACHE_SIZE
+#define IWT_FRAME_CACHE_SIZE 1
+#endif
+
+// FNV-1a offset basis, the hash of no input
+#define IWT_FRAME_CACHE_HASH_INIT 2166136261u
+
+/// <summary>
+///     A rendered frame and the hash of the inputs it was painted from.
+/// </summary>
+typedef struct {
+	bool valid;
+	uint32_t key;
+	uint32_t lastUse;
+	UBYTE frame[IWT_EPAPER_FRAME_SIZE];
+} iwt_frame_cache_entry_t;
+
+/// <summary>
+///     Cache of rendered frames, keyed by the hash of the screen inputs.
+/// </summary>
+typedef struct {
+	uint32_t useCounter;
+	iwt_frame_cache_entry_t entries[IWT_FRAME_CACHE_SIZE];
+} iwt_frame_cache_t;
+
+uint32_t iwt_frame_cache_hash(uint32_t hash, const void* data, size_t length);
+void iwt_frame_cache_init(iwt_frame_cache_t* cache);
+const UBYTE* iwt_frame_cache_lookup(iwt_frame_cache_t* cache, uint32_t key);
+void iwt_frame_cache_store(iwt_frame_cache_t* cache, uint32_t key, const UBYTE* frame);
@@ -0,0 +1,160 @@
+/* Enrique Albertos.
+   Licensed under the MIT License. */
+
+// Debounced buttons and switches.
+//
+// Every input is sampled from a single timer. A sample moves the input integrator one step
+// towards the level read, the debounced state flips when the integrator reaches the debounce
+// window, and press, release and long press events are reported to the handler.
+//
+// While an input is changing, waiting for its long press, or for IWT_INPUT_IDLE_AFTER_MS after
+// the last change, the inputs are polled every IWT_INPUT_ACTIVE_POLL_MS. Otherwise the poll
+// backs off to IWT_INPUT_IDLE_POLL_MS. A sample moves the integrator by the poll period it
+// ends. The idle period is at most half the debounce window, so a single sample at the idle
+// period never commits a change, and a press as long as the window is caught and committed
+// by the active samples that follow it. A high-level app gets no GPIO interrupt to wake it.
+
+#include <errno.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "iwt_input.h"
+
+_Static_assert(2 * IWT_INPUT_IDLE_POLL_MS <= IWT_INPUT_BUTTON_DEBOUNCE_MS, "Idle poll misses short presses");
+
+static void TimerExpiredHandler(Timer* timer);
+
+static void setPollPeriod(iwt_input_t* inputs, int pollMs) {
+	if (inputs->pollMs == pollMs) {
+		return;
+	}
+	ArmTimer(&inputs->timer, (uint32_t)pollMs, (uint32_t)pollMs);
+	inputs->pollMs = pollMs;
+}
+
+/// <summary>
+///     Initialize the poller and arm its timer at the idle period. The timer wheel must be created.
+/// </summary>
+/// <returns>0 on success</returns>
+int iwt_input_init(iwt_input_t* inputs, iwt_input_handler_t handler) {
+	memset(inputs, 0, sizeof(*inputs));
+	inputs->handler = handler;
+	inputs->timer.handler = &TimerExpiredHandler;
+	inputs->timer.context = inputs;
+	setPollPeriod(inputs, IWT_INPUT_IDLE_POLL_MS);
+	inputs->quietMs = IWT_INPUT_IDLE_AFTER_MS;
+	return 0;
+}
+
+/// <summary>
+///     Add an input. Its current level is its initial state, it reports no event for it.
+/// </summary>
+/// <param name="gpioFd">GPIO opened as input</param>
+/// <param name="activeLevel">Level read while the button is pressed or the switch closed</param>
+/// <param name="debounceMs">Time a new level must hold to count, at least twice IWT_INPUT_IDLE_POLL_MS</param>
+/// <returns>The input index, or -1 on failure</returns>
+int iwt_input_add(iwt_input_t* inputs, int gpioFd, GPIO_Value_Type activeLevel, int debounceMs) {
+	if (inputs->count == IWT_INPUT_MAX) {
+		Log_Debug("ERROR: more than %d inputs\n", IWT_INPUT_MAX);
+		return -1;
+	}
+	GPIO_Value_Type value;
+	if (GPIO_GetValue(gpioFd, &value) != 0) {
+		Log_Debug("ERROR: Could not read input GPIO: %s (%d).\n", strerror(errno), errno);
+		return -1;
+	}
+	iwt_input_pin_t* pin = &inputs->pins[inputs->count];
+	memset(pin, 0, sizeof(*pin));
+	pin->gpioFd = gpioFd;
+	pin->activeLevel = activeLevel;
+	pin->threshold = debounceMs < 2 * IWT_INPUT_IDLE_POLL_MS ? 2 * IWT_INPUT_IDLE_POLL_MS : debounceMs;
+	pin->active = value == activeLevel;
+	pin->integrator = pin->active ? pin->threshold : 0;
+	// An input found active is not held by a user, it reports no long press
+	pin->longPressSent = pin->active;
+	return inputs->count++;
+}
+
+/// <summary>
+///     Debounced state of an input.
+/// </summary>
+/// <returns>true while the button is pressed or the switch closed</returns>
+bool iwt_input_is_active(const iwt_input_t* inputs, int input) {
+	return input >= 0 && input < inputs->count && inputs->pins[input].active;
+}
+
+/// <summary>
+///     Cancel the poll timer. The GPIOs belong to the caller.
+/// </summary>
+void iwt_input_close(iwt_input_t* inputs) {
+	CancelTimer(&inputs->timer);
+}
+
+/// <summary>
+///     Sample an input and report its events.
+/// </summary>
+/// <returns>true if the input needs the active poll period</returns>
+static bool sampleInput(iwt_input_t* inputs, int input, const struct timespec* now) {
+	iwt_input_pin_t* pin = &inputs->pins[input];
+	GPIO_Value_Type value;
+	if (GPIO_GetValue(pin->gpioFd, &value) != 0) {
+		Log_Debug("ERROR: Could not read input GPIO: %s (%d).\n", strerror(errno), errno);
+		return false;
+	}
+
+	// The level read counts for the poll period that just ended
+	if (value == pin->activeLevel) {
+		pin->integrator += inputs->pollMs;
+		if (pin->integrator > pin->threshold) {
+			pin->integrator = pin->threshold;
+		}
+	} else {
+		pin->integrator -= inputs->pollMs;
+		if (pin->integrator < 0) {
+			pin->integrator = 0;
+		}
+	}
+
+	if (!pin->active && pin->integrator == pin->threshold) {
+		pin->active = true;
+		pin->longPressSent = false;
+		pin->activeSince = *now;
+		inputs->handler(input, IWT_INPUT_PRESS);
+	} else if (pin->active && pin->integrator == 0) {
+		pin->active = false;
+		inputs->handler(input, IWT_INPUT_RELEASE);
+	} else if (pin->active && !pin->longPressSent) {
+		long heldMs = (now->tv_sec - pin->activeSince.tv_sec) * 1000 +
+			(now->tv_nsec - pin->activeSince.tv_nsec) / 1000000;
+		if (heldMs >= IWT_INPUT_LONG_PRESS_MS) {
+			pin->longPressSent = true;
+			inputs->handler(input, IWT_INPUT_LONG_PRESS);
+		}
+	}
+
+	bool settled = pin->integrator == (pin->active ? pin->threshold : 0);
+	return !settled || (pin->active && !pin->longPressSent);
+}
+
+/// <summary>
+///     Poll timer: sample every input and adapt the poll period.
+/// </summary>
+static void TimerExpiredHandler(Timer* timer) {
+	iwt_input_t* inputs = timer->context;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	bool busy = false;
+	for (int i = 0; i < inputs->count; i++) {
+		if (sampleInput(inputs, i, &now)) {
+			busy = true;
+		}
+	}
+
+	if (busy) {
+		inputs->quietMs = 0;
+	} else if (inputs->quietMs < IWT_INPUT_IDLE_AFTER_MS) {
+		inputs->quietMs += inputs->pollMs;
+	}
+	setPollPeriod(inputs, inputs->quietMs < IWT_INPUT_IDLE_AFTER_MS ? IWT_INPUT_ACTIVE_POLL_MS : IWT_INPUT_IDLE_POLL_MS);
+}
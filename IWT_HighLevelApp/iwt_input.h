@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdbool.h>
+#include <time.h>
+#include <applibs/gpio.h>
+#include "epoll_timerfd_utilities.h"
+
+// Number of inputs a poller can sample
+#ifndef IWT_INPUT_MAX
+#define IWT_INPUT_MAX 4
+#endif
+// Poll period while an input is changing or held, and while idle. The idle period is at most
+// half the shortest debounce window, so a press as long as the window is never missed
+#ifndef IWT_INPUT_ACTIVE_POLL_MS
+#define IWT_INPUT_ACTIVE_POLL_MS 5
+#endif
+#ifndef IWT_INPUT_IDLE_POLL_MS
+#define IWT_INPUT_IDLE_POLL_MS 10
+#endif
+// Quiet time after the last change before polling backs off to the idle period
+#ifndef IWT_INPUT_IDLE_AFTER_MS
+#define IWT_INPUT_IDLE_AFTER_MS 500
+#endif
+// Debounce windows: a level must hold this long to count. The reed switch bounces longer
+#ifndef IWT_INPUT_BUTTON_DEBOUNCE_MS
+#define IWT_INPUT_BUTTON_DEBOUNCE_MS 20
+#endif
+#ifndef IWT_INPUT_REED_DEBOUNCE_MS
+#define IWT_INPUT_REED_DEBOUNCE_MS 50
+#endif
+// An input held this long reports a long press, before its release
+#ifndef IWT_INPUT_LONG_PRESS_MS
+#define IWT_INPUT_LONG_PRESS_MS 1500
+#endif
+
+typedef enum {
+	IWT_INPUT_PRESS,
+	IWT_INPUT_RELEASE,
+	IWT_INPUT_LONG_PRESS
+} iwt_input_event_t;
+
+/// <summary>
+///     Called from the epoll loop for every debounced input event.
+/// </summary>
+/// <param name="input">Input index, as returned by iwt_input_add</param>
+/// <param name="event">What happened</param>
+typedef void (*iwt_input_handler_t)(int input, iwt_input_event_t event);
+
+/// <summary>
+///     A debounced GPIO input. The integrator counts the milliseconds sampled at the active
+///     level and back, the debounced state only flips when it reaches either end, so a glitch
+///     shorter than the debounce window is absorbed.
+/// </summary>
+typedef struct {
+	int gpioFd;
+	GPIO_Value_Type activeLevel;
+	int threshold;	// Debounce window, ms
+	int integrator;	// 0 to threshold, ms
+	bool active;
+	bool longPressSent;
+	struct timespec activeSince;
+} iwt_input_pin_t;
+
+/// <summary>
+///     Input poller.
+/// </summary>
+typedef struct {
+	Timer timer;
+	iwt_input_handler_t handler;
+	int pollMs;
+	int quietMs;
+	int count;
+	iwt_input_pin_t pins[IWT_INPUT_MAX];
+} iwt_input_t;
+
+int iwt_input_init(iwt_input_t* inputs, iwt_input_handler_t handler);
+int iwt_input_add(iwt_input_t* inputs, int gpioFd, GPIO_Value_Type activeLevel, int debounceMs);
+bool iwt_input_is_active(const iwt_input_t* inputs, int input);
+void iwt_input_close(iwt_input_t* inputs);
@@ -0,0 +1,116 @@
+/* Enrique Albertos.
+   Licensed under the MIT License. */
+
+// Wi-Fi network monitor.
+//
+// The current network is sampled on a slow timer and kept, readers use the cached state
+// instead of asking WifiConfig. The changed callback only runs when the connection, the
+// SSID, the BSSID, the frequency or the RSSI bucket differ from the last report.
+//
+// After a change the network is sampled again in IWT_NETWORK_FAST_POLL_MS, to follow a
+// roaming or reconnecting station. Every unchanged sample doubles the period, up to
+// IWT_NETWORK_SLOW_POLL_MS. A new RSSI bucket alone is reported but does not count as a
+// change for the period, a station sitting on a bucket edge would keep it fast.
+
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "iwt_network.h"
+
+static void TimerExpiredHandler(Timer* timer);
+
+/// <summary>
+///     Bucket of a RSSI reading, rounded towards minus infinity so that 0 and -1 differ.
+/// </summary>
+static int rssiBucket(int8_t rssi) {
+	int bucket = rssi / IWT_NETWORK_RSSI_BUCKET_DB;
+	return (rssi % IWT_NETWORK_RSSI_BUCKET_DB) < 0 ? bucket - 1 : bucket;
+}
+
+/// <summary>
+///     Initialize the monitor, take the first sample and arm the sample timer. The timer
+///     wheel must be created. The first sample is always reported.
+/// </summary>
+/// <returns>0 on success</returns>
+int iwt_network_init(iwt_network_t* network, iwt_network_changed_t changed) {
+	memset(network, 0, sizeof(*network));
+	network->changed = changed;
+	network->timer.handler = &TimerExpiredHandler;
+	network->timer.context = network;
+	iwt_network_sample(network);
+	return 0;
+}
+
+/// <summary>
+///     Sample the network now, report it if it changed and schedule the next sample.
+/// </summary>
+void iwt_network_sample(iwt_network_t* network) {
+	iwt_network_state_t sample;
+	memset(&sample, 0, sizeof(sample));
+	WifiConfig_ConnectedNetwork current;
+	if (WifiConfig_GetCurrentNetwork(&current) >= 0) {
+		size_t ssidLength = current.ssidLength < WIFICONFIG_SSID_MAX_LENGTH ? current.ssidLength : WIFICONFIG_SSID_MAX_LENGTH;
+		sample.connected = true;
+		memcpy(sample.ssid, current.ssid, ssidLength);
+		memcpy(sample.bssid, current.bssid, sizeof(sample.bssid));
+		sample.frequencyMHz = current.frequencyMHz;
+		sample.rssi = current.signalRssi;
+		sample.rssiBucket = rssiBucket(current.signalRssi);
+	}
+
+	iwt_network_state_t* state = &network->state;
+	unsigned int changes = 0;
+	if (!network->sampled || sample.connected != state->connected) {
+		changes |= IWT_NETWORK_CONNECTED_CHANGED;
+	}
+	if (strcmp(sample.ssid, state->ssid) != 0) {
+		changes |= IWT_NETWORK_SSID_CHANGED;
+	}
+	if (memcmp(sample.bssid, state->bssid, sizeof(sample.bssid)) != 0) {
+		changes |= IWT_NETWORK_BSSID_CHANGED;
+	}
+	if (sample.frequencyMHz != state->frequencyMHz) {
+		changes |= IWT_NETWORK_FREQUENCY_CHANGED;
+	}
+	if (sample.rssiBucket != state->rssiBucket) {
+		changes |= IWT_NETWORK_RSSI_CHANGED;
+	}
+	*state = sample;
+	network->sampled = true;
+
+	if ((changes & ~IWT_NETWORK_RSSI_CHANGED) != 0) {
+		network->pollMs = IWT_NETWORK_FAST_POLL_MS;
+	} else if (network->pollMs < IWT_NETWORK_SLOW_POLL_MS) {
+		network->pollMs *= 2;
+		if (network->pollMs > IWT_NETWORK_SLOW_POLL_MS) {
+			network->pollMs = IWT_NETWORK_SLOW_POLL_MS;
+		}
+	}
+	ArmTimer(&network->timer, network->pollMs, 0);
+
+	if (changes != 0 && network->changed != NULL) {
+		network->changed(state, changes);
+	}
+}
+
+/// <summary>
+///     Last sampled state of the network.
+/// </summary>
+const iwt_network_state_t* iwt_network_state(const iwt_network_t* network) {
+	return &network->state;
+}
+
+/// <summary>
+///     Cancel the sample timer.
+/// </summary>
+void iwt_network_close(iwt_network_t* network) {
+	CancelTimer(&network->timer);
+}
+
+/// <summary>
+///     Sample timer.
+/// </summary>
+static void TimerExpiredHandler(Timer* timer) {
+	iwt_network_sample(timer->context);
+}
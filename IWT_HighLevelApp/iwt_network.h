@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <applibs/wificonfig.h>
+#include "epoll_timerfd_utilities.h"
+
+// Sample period right after a change, it doubles every unchanged sample up to the slow period
+#ifndef IWT_NETWORK_FAST_POLL_MS
+#define IWT_NETWORK_FAST_POLL_MS 2000
+#endif
+#ifndef IWT_NETWORK_SLOW_POLL_MS
+#define IWT_NETWORK_SLOW_POLL_MS 60000
+#endif
+// Width of the RSSI buckets, a change of signal within a bucket is not reported
+#ifndef IWT_NETWORK_RSSI_BUCKET_DB
+#define IWT_NETWORK_RSSI_BUCKET_DB 10
+#endif
+
+// What changed since the last report, a bit mask
+#define IWT_NETWORK_CONNECTED_CHANGED 0x01
+#define IWT_NETWORK_SSID_CHANGED 0x02
+#define IWT_NETWORK_BSSID_CHANGED 0x04
+#define IWT_NETWORK_FREQUENCY_CHANGED 0x08
+#define IWT_NETWORK_RSSI_CHANGED 0x10
+
+/// <summary>
+///     Last sample of the Wi-Fi network. ssid is null terminated, the other fields are
+///     zero while disconnected. rssi is the last reading, rssiBucket the one reported.
+/// </summary>
+typedef struct {
+	bool connected;
+	char ssid[WIFICONFIG_SSID_MAX_LENGTH + 1];
+	uint8_t bssid[WIFICONFIG_BSSID_BUFFER_SIZE];
+	uint32_t frequencyMHz;
+	int8_t rssi;
+	int rssiBucket;
+} iwt_network_state_t;
+
+/// <summary>
+///     Called from the epoll loop when the network changed.
+/// </summary>
+/// <param name="state">The new state, valid until the next sample</param>
+/// <param name="changes">IWT_NETWORK_*_CHANGED bits</param>
+typedef void (*iwt_network_changed_t)(const iwt_network_state_t* state, unsigned int changes);
+
+/// <summary>
+///     Wi-Fi network monitor.
+/// </summary>
+typedef struct {
+	Timer timer;
+	iwt_network_changed_t changed;
+	uint32_t pollMs;
+	bool sampled;
+	iwt_network_state_t state;
+} iwt_network_t;
+
+int iwt_network_init(iwt_network_t* network, iwt_network_changed_t changed);
+void iwt_network_sample(iwt_network_t* network);
+const iwt_network_state_t* iwt_network_state(const iwt_network_t* network);
+void iwt_network_close(iwt_network_t* network);
@@ -0,0 +1,109 @@
+/* Enrique Albertos.
+   Licensed under the MIT License. */
+
+// Event driven proximity.
+//
+// The VCNL4040 PS thresholds are set to the edges of a window of proximity counts and the
+// close and away interrupts are enabled: the sensor compares every measurement itself and
+// flags the first one out of the window. The owner sets the window, the fill level estimator
+// gives the counts its current level holds between with the current calibration.
+//
+// A slow timer checks for the flag: with the INT pin wired it reads the GPIO and touches the
+// I2C bus only when the pin is low, otherwise it reads the flag register, a single I2C read.
+// When a flag is set the count is read once and the changed callback runs. The driver keeps a
+// shadow copy of the registers, a threshold that does not move costs no I2C write.
+
+#include <errno.h>
+#include <string.h>
+
+#include <applibs/gpio.h>
+#include <applibs/log.h>
+
+#include "iwt_proximity.h"
+#include "vcnl4040.h"
+
+static void TimerExpiredHandler(Timer* timer);
+
+/// <summary>
+///     Initialize the service: open the window to every count, enable the proximity
+///     interrupts and arm the check timer. The sensor must be started with vcnl4040_begin and
+///     the timer wheel created. Nothing is reported until the window is narrowed.
+/// </summary>
+/// <param name="intGpioFd">GPIO wired to the INT pin, opened as input, or -1</param>
+/// <returns>0 on success</returns>
+int iwt_proximity_init(iwt_proximity_t* proximity, int intGpioFd, iwt_proximity_changed_t changed) {
+	memset(proximity, 0, sizeof(*proximity));
+	proximity->intGpioFd = intGpioFd;
+	proximity->timer.handler = &TimerExpiredHandler;
+	proximity->timer.context = proximity;
+	// Thresholds and interrupt type go to the sensor together
+	vcnl4040_beginConfigure();
+	iwt_proximity_set_window(proximity, 0, UINT16_MAX);
+	vcnl4040_setProxInterruptType(VCNL4040_PS_INT_BOTH);
+	if (vcnl4040_commitConfigure() != 0) {
+		Log_Debug("ERROR: Could not configure the proximity interrupts.\n");
+		return -1;
+	}
+	// Clear the flags of the measurements made before the thresholds were set
+	vcnl4040_getInterruptFlags();
+	proximity->changed = changed;
+	ArmTimer(&proximity->timer, IWT_PROXIMITY_POLL_MS, IWT_PROXIMITY_POLL_MS);
+	return 0;
+}
+
+/// <summary>
+///     Set the thresholds to the edges of the window. The close interrupt fires above high,
+///     the away interrupt below low.
+/// </summary>
+/// <returns>0 on success, -1 if the thresholds could not be written</returns>
+int iwt_proximity_set_window(iwt_proximity_t* proximity, uint16_t low, uint16_t high) {
+	vcnl4040_beginConfigure();
+	vcnl4040_setProxLowThreshold(low);
+	vcnl4040_setProxHighThreshold(high);
+	if (vcnl4040_commitConfigure() != 0) {
+		Log_Debug("ERROR: Could not set the proximity window %u to %u.\n", low, high);
+		return -1;
+	}
+	proximity->low = low;
+	proximity->high = high;
+	return 0;
+}
+
+/// <summary>
+///     Read the count out of the window and report it.
+/// </summary>
+static void update(iwt_proximity_t* proximity) {
+	proximity->count = vcnl4040_getProximity();
+	if (proximity->changed != NULL) {
+		proximity->changed(proximity->count);
+	}
+}
+
+/// <summary>
+///     Cancel the check timer and disable the proximity interrupts.
+/// </summary>
+void iwt_proximity_close(iwt_proximity_t* proximity) {
+	CancelTimer(&proximity->timer);
+	vcnl4040_setProxInterruptType(VCNL4040_PS_INT_DISABLE);
+}
+
+/// <summary>
+///     Check timer: look for a close or away interrupt.
+/// </summary>
+static void TimerExpiredHandler(Timer* timer) {
+	iwt_proximity_t* proximity = timer->context;
+	if (proximity->intGpioFd >= 0) {
+		GPIO_Value_Type value;
+		if (GPIO_GetValue(proximity->intGpioFd, &value) != 0) {
+			Log_Debug("ERROR: Could not read proximity INT GPIO: %s (%d).\n", strerror(errno), errno);
+			return;
+		}
+		if (value == GPIO_Value_High) {
+			return;
+		}
+	}
+	uint8_t flags = vcnl4040_getInterruptFlags();
+	if ((flags & (VCNL4040_INT_FLAG_CLOSE | VCNL4040_INT_FLAG_AWAY)) != 0) {
+		update(proximity);
+	}
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "epoll_timerfd_utilities.h"
+
+// Period of the interrupt check. With the INT pin wired it only reads the GPIO, otherwise
+// it reads the interrupt flags over I2C
+#ifndef IWT_PROXIMITY_POLL_MS
+#define IWT_PROXIMITY_POLL_MS 1000
+#endif
+
+/// <summary>
+///     Called from the epoll loop when a proximity reading left the window.
+/// </summary>
+/// <param name="count">The proximity reading</param>
+typedef void (*iwt_proximity_changed_t)(uint16_t count);
+
+/// <summary>
+///     Threshold driven proximity service. The sensor thresholds bound a window of counts set
+///     by the owner, so the sensor only raises its interrupt when a reading leaves it.
+/// </summary>
+typedef struct {
+	Timer timer;
+	int intGpioFd;
+	iwt_proximity_changed_t changed;
+	uint16_t low;
+	uint16_t high;
+	uint16_t count;
+} iwt_proximity_t;
+
+int iwt_proximity_init(iwt_proximity_t* proximity, int intGpioFd, iwt_proximity_changed_t changed);
+int iwt_proximity_set_window(iwt_proximity_t* proximity, uint16_t low, uint16_t high);
+void iwt_proximity_close(iwt_proximity_t* proximity);
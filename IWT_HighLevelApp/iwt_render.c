@@ -0,0 +1,109 @@
+/* Enrique Albertos.
+   Licensed under the MIT License. */
+
+// Render scheduler between the input handlers and the e-paper display.
+//
+// Screens are requested with a priority and painted when the panel is free, so a burst of
+// input never queues refresh after refresh: while a refresh is in flight the requests
+// collapse into a single pending one, the latest wins, unless the pending one has a higher
+// priority. The panel is at most one frame behind.
+//
+// A screen is shown at least minDwellMs before a screen of the same or lower priority
+// replaces it, a higher priority screen, e.g. a QR code, does not wait.
+
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "iwt_render.h"
+
+static void TimerExpiredHandler(Timer* timer);
+
+/// <summary>
+///     Initialize the scheduler, its dwell timer disarmed. The timer wheel must be created.
+/// </summary>
+/// <returns>0 on success</returns>
+int iwt_render_init(iwt_render_t* render, iwt_epaper_t* epaper, iwt_render_paint_t paint, int minDwellMs) {
+	memset(render, 0, sizeof(*render));
+	render->epaper = epaper;
+	render->paint = paint;
+	render->minDwellMs = minDwellMs;
+	render->timer.handler = &TimerExpiredHandler;
+	render->timer.context = render;
+	return 0;
+}
+
+/// <summary>
+///     Cancel the dwell timer. A pending request is dropped.
+/// </summary>
+void iwt_render_close(iwt_render_t* render) {
+	render->pending = false;
+	CancelTimer(&render->timer);
+}
+
+/// <summary>
+///     Milliseconds the shown screen still has to stay, 0 if the pending one may replace it.
+/// </summary>
+static long remainingDwellMs(const iwt_render_t* render) {
+	if (!render->shown || render->pendingPriority > render->shownPriority) {
+		return 0;
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long elapsedMs = (now.tv_sec - render->shownAt.tv_sec) * 1000 +
+		(now.tv_nsec - render->shownAt.tv_nsec) / 1000000;
+	return elapsedMs >= render->minDwellMs ? 0 : render->minDwellMs - elapsedMs;
+}
+
+/// <summary>
+///     Paint the pending screen if the panel is free and the shown one has dwelt long enough,
+///     otherwise wait for the end of the refresh or for the dwell timer.
+/// </summary>
+static void dispatch(iwt_render_t* render) {
+	if (!render->pending || iwt_epaper_busy(render->epaper)) {
+		return;
+	}
+	long waitMs = remainingDwellMs(render);
+	if (waitMs > 0) {
+		ArmTimer(&render->timer, (uint32_t)waitMs, 0);
+		return;
+	}
+	CancelTimer(&render->timer);
+	render->pending = false;
+	render->shown = true;
+	render->shownPriority = render->pendingPriority;
+	clock_gettime(CLOCK_MONOTONIC, &render->shownAt);
+	if (render->paint(render->pendingScreen) != 0) {
+		Log_Debug("ERROR: render of screen %d failed\n", render->pendingScreen);
+	}
+}
+
+/// <summary>
+///     Ask for a screen. It is painted at once if the panel is free, otherwise it replaces
+///     the pending request, unless that one has a higher priority.
+/// </summary>
+void iwt_render_request(iwt_render_t* render, int screen, int priority) {
+	if (render->pending && render->pendingPriority > priority) {
+		Log_Debug("Render: screen %d dropped, screen %d pending\n", screen, render->pendingScreen);
+		return;
+	}
+	render->pending = true;
+	render->pendingScreen = screen;
+	render->pendingPriority = priority;
+	dispatch(render);
+}
+
+/// <summary>
+///     The display finished a refresh, paint the pending screen if any.
+/// </summary>
+void iwt_render_refreshed(iwt_render_t* render) {
+	dispatch(render);
+}
+
+/// <summary>
+///     Dwell timer: the shown screen may be replaced now.
+/// </summary>
+static void TimerExpiredHandler(Timer* timer) {
+	iwt_render_t* render = timer->context;
+	dispatch(render);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <time.h>
+#include "epoll_timerfd_utilities.h"
+#include "iwt_epaper.h"
+
+// A screen stays at least this long before a screen of the same or lower priority replaces it
+#ifndef IWT_RENDER_MIN_DWELL_MS
+#define IWT_RENDER_MIN_DWELL_MS 1500
+#endif
+
+/// <summary>
+///     Paints a screen and hands it to the display.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+typedef int (*iwt_render_paint_t)(int screen);
+
+/// <summary>
+///     Render scheduler: the screen shown last and the one request waiting for the panel.
+/// </summary>
+typedef struct {
+	Timer timer;
+	iwt_epaper_t* epaper;
+	iwt_render_paint_t paint;
+	int minDwellMs;
+	// Latest request not painted yet
+	bool pending;
+	int pendingScreen;
+	int pendingPriority;
+	// Screen painted last
+	bool shown;
+	int shownPriority;
+	struct timespec shownAt;
+} iwt_render_t;
+
+int iwt_render_init(iwt_render_t* render, iwt_epaper_t* epaper, iwt_render_paint_t paint, int minDwellMs);
+void iwt_render_request(iwt_render_t* render, int screen, int priority);
+void iwt_render_refreshed(iwt_render_t* render);
+void iwt_render_close(iwt_render_t* render);
@@ -0,0 +1,131 @@
+/* Enrique Albertos.
+   Licensed under the MIT License. */
+
+// Deadband telemetry producer.
+//
+// The value is sampled on a timer but only sent when it moved at least the deadband from the
+// last value sent, or when the heartbeat time went by without a message, so a quiet device
+// still shows up as alive. Every message carries the last sample and the min, max and mean of
+// the samples taken since the previous message:
+//
+//     {"FillLevel":42,"FillLevelMin":38,"FillLevelMax":42,"FillLevelMean":40.3}
+//
+// A message that can not be handed over keeps the window, the next sample tries again.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "iwt_telemetry.h"
+
+static void TimerExpiredHandler(Timer* timer);
+
+/// <summary>
+///     Initialize the producer with the default deadband and heartbeat and arm the sample
+///     timer. The timer wheel must be created. The first sample is always sent.
+/// </summary>
+/// <param name="name">Telemetry name, the JSON key, the aggregates append Min, Max and Mean</param>
+/// <param name="periodMs">Sample period</param>
+/// <returns>0 on success</returns>
+int iwt_telemetry_init(iwt_telemetry_t* telemetry, const char* name, uint32_t periodMs,
+	iwt_telemetry_sample_t sample, iwt_telemetry_send_t send) {
+	memset(telemetry, 0, sizeof(*telemetry));
+	telemetry->timer.handler = &TimerExpiredHandler;
+	telemetry->timer.context = telemetry;
+	telemetry->name = name;
+	telemetry->sample = sample;
+	telemetry->send = send;
+	telemetry->periodMs = periodMs;
+	if (iwt_telemetry_configure(telemetry, IWT_TELEMETRY_DEADBAND, IWT_TELEMETRY_HEARTBEAT_MS) != 0) {
+		return -1;
+	}
+	ArmTimer(&telemetry->timer, periodMs, periodMs);
+	return 0;
+}
+
+/// <summary>
+///     Set the deadband and the heartbeat. They apply from the next sample.
+/// </summary>
+/// <param name="deadband">Change from the last value sent that is worth a message, at least 1</param>
+/// <param name="heartbeatMs">Longest time without a message, at least the sample period</param>
+/// <returns>0 on success, -1 if the values are out of range</returns>
+int iwt_telemetry_configure(iwt_telemetry_t* telemetry, int deadband, uint32_t heartbeatMs) {
+	if (deadband < 1 || heartbeatMs < telemetry->periodMs) {
+		Log_Debug("ERROR: Invalid %s telemetry deadband %d or heartbeat %u ms.\n", telemetry->name, deadband, heartbeatMs);
+		return -1;
+	}
+	telemetry->deadband = deadband;
+	telemetry->heartbeatMs = heartbeatMs;
+	return 0;
+}
+
+/// <summary>
+///     Send the window with the last sample as value.
+/// </summary>
+static void sendWindow(iwt_telemetry_t* telemetry, int value) {
+	char message[IWT_TELEMETRY_MESSAGE_SIZE];
+	const char* name = telemetry->name;
+	double mean = (double)telemetry->sum / telemetry->count;
+	int length = snprintf(message, sizeof(message), "{\"%s\":%d,\"%sMin\":%d,\"%sMax\":%d,\"%sMean\":%.1f}",
+		name, value, name, telemetry->min, name, telemetry->max, name, mean);
+	if (length < 0 || (size_t)length >= sizeof(message)) {
+		Log_Debug("ERROR: %s telemetry message too long.\n", name);
+		return;
+	}
+	if (!telemetry->send(message)) {
+		return;
+	}
+	telemetry->sent = true;
+	telemetry->lastSent = value;
+	telemetry->sinceSendMs = 0;
+	telemetry->count = 0;
+	telemetry->messages++;
+}
+
+/// <summary>
+///     Take a sample now, add it to the window and send the window if the value moved past
+///     the deadband or the heartbeat is due.
+/// </summary>
+void iwt_telemetry_sample_now(iwt_telemetry_t* telemetry) {
+	int value = telemetry->sample();
+	telemetry->samples++;
+	if (telemetry->count == 0) {
+		telemetry->min = value;
+		telemetry->max = value;
+		telemetry->sum = 0;
+	}
+	if (value < telemetry->min) {
+		telemetry->min = value;
+	}
+	if (value > telemetry->max) {
+		telemetry->max = value;
+	}
+	telemetry->sum += value;
+	telemetry->count++;
+
+	if (!telemetry->sent
+		|| abs(value - telemetry->lastSent) >= telemetry->deadband
+		|| telemetry->sinceSendMs >= telemetry->heartbeatMs) {
+		sendWindow(telemetry, value);
+	}
+}
+
+/// <summary>
+///     Cancel the sample timer.
+/// </summary>
+void iwt_telemetry_close(iwt_telemetry_t* telemetry) {
+	CancelTimer(&telemetry->timer);
+}
+
+/// <summary>
+///     Sample timer.
+/// </summary>
+static void TimerExpiredHandler(Timer* timer) {
+	iwt_telemetry_t* telemetry = timer->context;
+	if (telemetry->sinceSendMs < telemetry->heartbeatMs) {
+		telemetry->sinceSendMs += telemetry->periodMs;
+	}
+	iwt_telemetry_sample_now(telemetry);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "epoll_timerfd_utilities.h"
+
+// A sample is sent when it moved this much from the last value sent
+#ifndef IWT_TELEMETRY_DEADBAND
+#define IWT_TELEMETRY_DEADBAND 5
+#endif
+// Longest time without a message, the last value is sent again after it
+#ifndef IWT_TELEMETRY_HEARTBEAT_MS
+#define IWT_TELEMETRY_HEARTBEAT_MS (60 * 60 * 1000)
+#endif
+// Room for a message with the value and the aggregates of the window
+#ifndef IWT_TELEMETRY_MESSAGE_SIZE
+#define IWT_TELEMETRY_MESSAGE_SIZE 160
+#endif
+
+/// <summary>
+///     Reads the current value of the telemetry. Called from the epoll loop, it must not block.
+/// </summary>
+typedef int (*iwt_telemetry_sample_t)(void);
+
+/// <summary>
+///     Hands a JSON message over for delivery.
+/// </summary>
+/// <returns>true if the message was accepted, otherwise the window is kept and sent later</returns>
+typedef bool (*iwt_telemetry_send_t)(const char* message);
+
+/// <summary>
+///     Telemetry producer of an integer value.
+/// </summary>
+typedef struct {
+	Timer timer;
+	const char* name;
+	iwt_telemetry_sample_t sample;
+	iwt_telemetry_send_t send;
+	int deadband;
+	uint32_t periodMs;
+	uint32_t heartbeatMs;
+	uint32_t sinceSendMs;
+	bool sent;
+	int lastSent;
+	// Aggregates of the samples since the last message
+	unsigned int count;
+	int min;
+	int max;
+	int64_t sum;
+	// Samples taken and messages sent, for the stats
+	unsigned int samples;
+	unsigned int messages;
+} iwt_telemetry_t;
+
+int iwt_telemetry_init(iwt_telemetry_t* telemetry, const char* name, uint32_t periodMs,
+	iwt_telemetry_sample_t sample, iwt_telemetry_send_t send);
+int iwt_telemetry_configure(iwt_telemetry_t* telemetry, int deadband, uint32_t heartbeatMs);
+void iwt_telemetry_sample_now(iwt_telemetry_t* telemetry);
+void iwt_telemetry_close(iwt_telemetry_t* telemetry);
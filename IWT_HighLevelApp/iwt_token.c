@@ -0,0 +1,267 @@
+/* Enrique Albertos.
+   Licensed under the MIT License. */
+
+// Mints signed tokens and encodes them as QR codes.
+// All the intermediate buffers live in the context arena, no heap memory is used.
+//
+// Default profile: HS256 JSON Web Token. The token is written in a single pass: each claim is
+// base64url encoded straight into the token buffer and every encoded chunk is fed to the HMAC
+// as it is produced.
+//
+// IWT_COMPACT_TOKEN_PROFILE (build_options.h): CWT-like binary claims in a fixed layout,
+// all fields big endian, encoded in byte mode. Decoded by tools/iwt_compact_token.py
+//   [0]       profile version, IWT_COMPACT_TOKEN_VERSION
+//   [1..2]    device index
+//   [3..6]    jti, random
+//   [7..10]   iat, Unix time
+//   [11..18]  HMAC-SHA256 of bytes 0..10 truncated to 64 bits
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "build_options.h"
+#include "iwt_token.h"
+#include "iwt_base64.h"
+
+#ifndef IWT_COMPACT_TOKEN_PROFILE
+// JSON WEB TOKEN payload, split around the device id:
+// {"jti":"<deviceId>-<random>-<iat>","iat":<iat>}
+static const char cstrJWTPayloadJsonHead[] = "{\"jti\":\"";
+static const char cstrJWTPayloadJsonTail[] = "-%08x-%08x\",\"iat\":%d}";
+static const char cstrJWTHeaderJson[] = "{\"alg\":\"HS256\",\"typ\":\"JWT\"}";
+
+// Encodes part of the token and signs the encoded characters on the fly
+typedef struct {
+	iwt_base64url_encoder_t encoder;
+	iwt_hmac_stream_t stream;
+	int error;
+} token_writer_t;
+
+static void writeEncoded(token_writer_t* writer, const void* data, size_t len) {
+	const char* chunk = writer->encoder.out;
+	size_t written = iwt_base64url_update(&writer->encoder, (const unsigned char*)data, len);
+	if (iwt_crypto_stream_update(&writer->stream, (const uint8_t*)chunk, (uint32_t)written) != 0) {
+		writer->error = 1;
+	}
+}
+
+static void finishEncoded(token_writer_t* writer) {
+	const char* chunk = writer->encoder.out;
+	size_t written = iwt_base64url_finish(&writer->encoder);
+	if (iwt_crypto_stream_update(&writer->stream, (const uint8_t*)chunk, (uint32_t)written) != 0) {
+		writer->error = 1;
+	}
+}
+#endif // IWT_COMPACT_TOKEN_PROFILE
+
+/// <summary>
+///     Initialize the mint context. The JSON Web Token header never changes, so it is encoded
+///     and hashed only once, and the key is turned into HMAC midstates. deviceId must outlive the context.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+int iwt_token_init(iwt_token_ctx_t* ctx, const char* deviceId, uint16_t deviceIndex, const uint8_t* key, uint32_t keySize) {
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->deviceId = deviceId;
+	ctx->deviceIndex = deviceIndex;
+	ctx->deviceIdLength = strlen(deviceId);
+	if (ctx->deviceIdLength > IWT_TOKEN_DEVICE_ID_MAX) {
+		Log_Debug("ERROR: Device ID longer than %d characters\n", IWT_TOKEN_DEVICE_ID_MAX);
+		return -1;
+	}
+	int ret = iwt_crypto_signer_init(&ctx->signer, key, keySize);
+	if (ret != 0) {
+		Log_Debug("ERROR: JWT signer init failed (%d)\n", ret);
+		return -1;
+	}
+#ifndef IWT_COMPACT_TOKEN_PROFILE
+	if (strlen(cstrJWTHeaderJson) > IWT_TOKEN_HEADER_SIZE) {
+		Log_Debug("ERROR: JWT header does not fit in the token arena\n");
+		return -1;
+	}
+
+	// Every token starts with "base64url(header)."
+	token_writer_t writer;
+	writer.error = 0;
+	if (iwt_crypto_stream_begin(&ctx->signer, &writer.stream) != 0) {
+		return -1;
+	}
+	iwt_base64url_begin(&writer.encoder, ctx->arena.header);
+	writeEncoded(&writer, cstrJWTHeaderJson, strlen(cstrJWTHeaderJson));
+	finishEncoded(&writer);
+	*writer.encoder.out++ = '.';
+	if (iwt_crypto_stream_update(&writer.stream, (const uint8_t*)".", 1) != 0) {
+		writer.error = 1;
+	}
+	int copied = writer.error ? -1 : iwt_crypto_stream_copy(&writer.stream, &ctx->headerStream);
+	iwt_crypto_stream_wipe(&writer.stream);
+	if (copied != 0) {
+		Log_Debug("ERROR: JWT header signature failed\n");
+		return -1;
+	}
+	*writer.encoder.out = '\0';
+	ctx->headerLength = (size_t)(writer.encoder.out - ctx->arena.header);
+#endif // IWT_COMPACT_TOKEN_PROFILE
+	return 0;
+}
+
+#ifndef IWT_COMPACT_TOKEN_PROFILE
+/// <summary>
+///     Write a signed JSON Web Token into token->token.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+static int writeJsonWebToken(iwt_token_ctx_t* ctx, iwt_token_t* token, uint32_t jti, long issuedAt) {
+	iwt_token_arena_t* arena = &ctx->arena;
+	char claims[sizeof(cstrJWTPayloadJsonTail) + 3 * 11];
+
+	int claimsLength = snprintf(claims, sizeof(claims), cstrJWTPayloadJsonTail,
+		jti, (unsigned int)issuedAt, (int)issuedAt);
+	if (claimsLength < 0 || claimsLength >= (int)sizeof(claims)) {
+		return -1;
+	}
+
+	// The header and its HMAC state were prepared by iwt_token_init
+	token_writer_t writer;
+	writer.error = 0;
+	if (iwt_crypto_stream_copy(&ctx->headerStream, &writer.stream) != 0) {
+		iwt_crypto_stream_wipe(&writer.stream);
+		return -1;
+	}
+	memcpy(token->token, arena->header, ctx->headerLength);
+	iwt_base64url_begin(&writer.encoder, token->token + ctx->headerLength);
+	writeEncoded(&writer, cstrJWTPayloadJsonHead, sizeof(cstrJWTPayloadJsonHead) - 1);
+	writeEncoded(&writer, ctx->deviceId, ctx->deviceIdLength);
+	writeEncoded(&writer, claims, (size_t)claimsLength);
+	finishEncoded(&writer);
+	if (writer.error) {
+		iwt_crypto_stream_wipe(&writer.stream);
+	}
+	if (writer.error || iwt_crypto_stream_final(&ctx->signer, &writer.stream, arena->signature) != 0) {
+		Log_Debug("ERROR: JWT signature failed\n");
+		return -1;
+	}
+
+	*writer.encoder.out++ = '.';
+	iwt_base64url_update(&writer.encoder, arena->signature, SHA256_DIGEST_SIZE);
+	iwt_base64url_finish(&writer.encoder);
+	token->tokenLength = (size_t)(writer.encoder.out - token->token);
+	Log_Debug("WebToken: %s, Length: %d\n", token->token, (int)token->tokenLength);
+	return 0;
+}
+#else
+static uint8_t* putUint16(uint8_t* p, uint16_t value) {
+	*p++ = (uint8_t)(value >> 8);
+	*p++ = (uint8_t)value;
+	return p;
+}
+
+static uint8_t* putUint32(uint8_t* p, uint32_t value) {
+	p = putUint16(p, (uint16_t)(value >> 16));
+	return putUint16(p, (uint16_t)value);
+}
+
+/// <summary>
+///     Write a compact binary token into token->token.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+static int writeCompactToken(iwt_token_ctx_t* ctx, iwt_token_t* token, uint32_t jti, long issuedAt) {
+	uint8_t* p = (uint8_t*)token->token;
+	*p++ = IWT_COMPACT_TOKEN_VERSION;
+	p = putUint16(p, ctx->deviceIndex);
+	p = putUint32(p, jti);
+	p = putUint32(p, (uint32_t)issuedAt);
+	if (iwt_crypto_signer_sign(&ctx->signer, ctx->arena.signature, (const uint8_t*)token->token, IWT_COMPACT_TOKEN_CLAIMS_SIZE) != 0) {
+		Log_Debug("ERROR: Token signature failed\n");
+		return -1;
+	}
+	memcpy(p, ctx->arena.signature, IWT_COMPACT_TOKEN_MAC_SIZE);
+	token->tokenLength = IWT_COMPACT_TOKEN_SIZE;
+	Log_Debug("Compact token: device %u, jti %08x, iat %u\n", ctx->deviceIndex, jti, (unsigned int)issuedAt);
+	return 0;
+}
+#endif // IWT_COMPACT_TOKEN_PROFILE
+
+/// <summary>
+///     Mint a new signed token and encode it as a QR code.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+int iwt_token_mint(iwt_token_ctx_t* ctx, iwt_token_t* token, uint32_t jti, long issuedAt) {
+	iwt_token_arena_t* arena = &ctx->arena;
+	bool ok;
+#ifndef IWT_COMPACT_TOKEN_PROFILE
+	if (writeJsonWebToken(ctx, token, jti, issuedAt) != 0) {
+		return -1;
+	}
+	ok = qrcodegen_encodeText(token->token, arena->qrTempBuffer, token->qrcode, qrcodegen_Ecc_LOW,
+		qrcodegen_VERSION_MIN, IWT_TOKEN_QR_VERSION_MAX, qrcodegen_Mask_AUTO, true);
+#else
+	if (writeCompactToken(ctx, token, jti, issuedAt) != 0) {
+		return -1;
+	}
+	// encodeBinary takes its input from the temporary buffer
+	memcpy(arena->qrTempBuffer, token->token, token->tokenLength);
+	ok = qrcodegen_encodeBinary(arena->qrTempBuffer, token->tokenLength, token->qrcode, qrcodegen_Ecc_LOW,
+		qrcodegen_VERSION_MIN, IWT_TOKEN_QR_VERSION_MAX, qrcodegen_Mask_AUTO, true);
+#endif // IWT_COMPACT_TOKEN_PROFILE
+	if (!ok) {
+		Log_Debug("ERROR: Token does not fit in a version %d QR code\n", IWT_TOKEN_QR_VERSION_MAX);
+		return -1;
+	}
+	token->jti = jti;
+	token->issuedAt = issuedAt;
+	return 0;
+}
+
+/// <summary>
+///     Drop the pre-minted tokens that are no longer fresh.
+/// </summary>
+static void dropStaleTokens(iwt_token_ring_t* ring, long now) {
+	while (ring->count > 0) {
+		long age = now - ring->entries[ring->head].issuedAt;
+		if (age >= 0 && age <= IWT_TOKEN_FRESHNESS_SECONDS) {
+			break;
+		}
+		ring->head = (ring->head + 1) % IWT_TOKEN_RING_SIZE;
+		ring->count--;
+	}
+}
+
+/// <summary>
+///     Idle work: mint one token into the ring if it is not full. Stale tokens are only
+///     dropped by iwt_token_ring_take, so the ring is refilled after a take and an idle
+///     device does not mint again every IWT_TOKEN_FRESHNESS_SECONDS.
+/// </summary>
+/// <returns>true if the ring still has room for more tokens</returns>
+bool iwt_token_ring_refill(iwt_token_ctx_t* ctx, long now) {
+	iwt_token_ring_t* ring = &ctx->arena.ring;
+	if (ring->count == IWT_TOKEN_RING_SIZE) {
+		return false;
+	}
+	iwt_token_t* token = &ring->entries[(ring->head + ring->count) % IWT_TOKEN_RING_SIZE];
+	if (iwt_token_mint(ctx, token, (uint32_t)rand(), now) != 0) {
+		return false;
+	}
+	ring->count++;
+	return ring->count < IWT_TOKEN_RING_SIZE;
+}
+
+/// <summary>
+///     Take the freshest pre-minted token, minting one on the spot if none is fresh.
+///     The token stays valid until the next call to iwt_token_ring_refill.
+/// </summary>
+/// <returns>The token, or NULL on failure</returns>
+const iwt_token_t* iwt_token_ring_take(iwt_token_ctx_t* ctx, long now) {
+	iwt_token_ring_t* ring = &ctx->arena.ring;
+	dropStaleTokens(ring, now);
+	if (ring->count > 0) {
+		ring->count--;
+		return &ring->entries[(ring->head + ring->count) % IWT_TOKEN_RING_SIZE];
+	}
+	iwt_token_t* token = &ring->entries[ring->head];
+	if (iwt_token_mint(ctx, token, (uint32_t)rand(), now) != 0) {
+		return NULL;
+	}
+	return token;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "build_options.h"
+#include "iwt_crypto.h"
+#include "qr/qrcodegen.h"
+
+// Largest QR version a token may need. A signed token with a 199 character device id
+// is about 410 bytes, version 20 at ECC LOW holds 858 bytes.
+#define IWT_TOKEN_QR_VERSION_MAX 20
+#define IWT_TOKEN_QR_BUFFER_LEN qrcodegen_BUFFER_LEN_FOR_VERSION(IWT_TOKEN_QR_VERSION_MAX)
+
+// Base64 characters needed for n bytes, plus the terminating null
+#define IWT_TOKEN_BASE64_LEN(n) ((((n) + 2) / 3) * 4 + 1)
+
+#define IWT_TOKEN_DEVICE_ID_MAX 199
+#define IWT_TOKEN_HEADER_SIZE 64
+// Bounds the JSON payload: 46 bytes of claims plus the device id
+#define IWT_TOKEN_PAYLOAD_SIZE 256
+#define IWT_TOKEN_SIZE (IWT_TOKEN_BASE64_LEN(IWT_TOKEN_HEADER_SIZE) + IWT_TOKEN_BASE64_LEN(IWT_TOKEN_PAYLOAD_SIZE) + IWT_TOKEN_BASE64_LEN(SHA256_DIGEST_SIZE))
+
+// Compact binary token profile, see iwt_token.c
+#define IWT_COMPACT_TOKEN_VERSION 1
+#define IWT_COMPACT_TOKEN_CLAIMS_SIZE 11
+#define IWT_COMPACT_TOKEN_MAC_SIZE 8
+#define IWT_COMPACT_TOKEN_SIZE (IWT_COMPACT_TOKEN_CLAIMS_SIZE + IWT_COMPACT_TOKEN_MAC_SIZE)
+
+// Number of tokens minted ahead of time, during idle time
+#ifndef IWT_TOKEN_RING_SIZE
+#define IWT_TOKEN_RING_SIZE 2
+#endif
+// Pre-minted tokens whose "iat" is older than this are discarded
+#ifndef IWT_TOKEN_FRESHNESS_SECONDS
+#define IWT_TOKEN_FRESHNESS_SECONDS 30
+#endif
+
+/// <summary>
+///     A minted token and its QR code. token is a null terminated string for the
+///     JSON Web Token profile and tokenLength raw bytes for the compact profile.
+/// </summary>
+typedef struct {
+	uint32_t jti;
+	long issuedAt;
+	size_t tokenLength;
+	char token[IWT_TOKEN_SIZE];
+	uint8_t qrcode[IWT_TOKEN_QR_BUFFER_LEN];
+} iwt_token_t;
+
+/// <summary>
+///     Ring of pre-minted tokens, oldest first.
+/// </summary>
+typedef struct {
+	iwt_token_t entries[IWT_TOKEN_RING_SIZE];
+	int head;
+	int count;
+} iwt_token_ring_t;
+
+/// <summary>
+///     Every buffer used to mint a token. Allocated once, together with the context,
+///     so that minting a token never touches the heap.
+/// </summary>
+typedef struct {
+	uint8_t signature[SHA256_DIGEST_SIZE];
+	uint8_t qrTempBuffer[IWT_TOKEN_QR_BUFFER_LEN];
+#ifndef IWT_COMPACT_TOKEN_PROFILE
+	char header[IWT_TOKEN_BASE64_LEN(IWT_TOKEN_HEADER_SIZE) + 1];
+#endif
+	iwt_token_ring_t ring;
+} iwt_token_arena_t;
+
+/// <summary>
+///     Token mint context: device identity, signer and the arena.
+///     The encoded JSON Web Token header and its HMAC state are computed once, every token
+///     starts from them. The compact profile has no header.
+/// </summary>
+typedef struct {
+	const char* deviceId;
+	size_t deviceIdLength;
+	uint16_t deviceIndex;
+	iwt_hmac_signer_t signer;
+#ifndef IWT_COMPACT_TOKEN_PROFILE
+	iwt_hmac_stream_t headerStream;
+	size_t headerLength;
+#endif
+	iwt_token_arena_t arena;
+} iwt_token_ctx_t;
+
+int iwt_token_init(iwt_token_ctx_t* ctx, const char* deviceId, uint16_t deviceIndex, const uint8_t* key, uint32_t keySize);
+int iwt_token_mint(iwt_token_ctx_t* ctx, iwt_token_t* token, uint32_t jti, long issuedAt);
+bool iwt_token_ring_refill(iwt_token_ctx_t* ctx, long now);
+const iwt_token_t* iwt_token_ring_take(iwt_token_ctx_t* ctx, long now);
@@ -61,10 +61,19 @@
 
 #include "epd/EPD_1in54.h"
 #include "gui/GUI_Paint.h"
+#include "iwt_epaper.h"
+#include "iwt_frame_cache.h"
+#include "iwt_render.h"
+#include "iwt_input.h"
+#include "iwt_network.h"
+#include "iwt_proximity.h"
+#include "iwt_fill_level.h"
+#include "iwt_telemetry.h"
 
 #include "qr/qrcodegen.h"
 #include "iwt_base64.h"
 #include "iwt_crypto.h"
+#include "iwt_token.h"
 #include "iwt_image.h"
 
 #include "build_options.h"
@@ -106,84 +115,141 @@ static int epaperSpiBusyFd = -1;
 
 static int epaperSpiResetFd = -1;
 static int spiFd = -1;
-static int buttonPollTimerFd = -1;
 static int buttonAGpioFd = -1;
 static int buttonBGpioFd = -1;
 
-static int gotoMainScreenTimerFd = -1;
 
 
 #ifdef REED_SWITCH_INCLUDED
 static int reedSwitchFd = -1;
-static GPIO_Value_Type reedSwitchState = GPIO_Value_Low;
 #endif
 
-#define BUFFER_SIZE 2048
+// Define the Json string format for the button press data, an item of the buttonA list
+const char cstrButtonTelemetryJson[] = "\"%d\"";
 
-// "iat" (Issued At) 
-// Claim The "iat" (issued at) claim identifies the time at which the JWT was
-// issued.This claim can be used to determine the age of the JWT.Its
-// value MUST be a number containing a NumericDate value.
 
-//"jti" (JWT ID) Claim
-//The "jti" (JWT ID) claim provides a unique identifier for the JWT.
-//The identifier value MUST be assigned in a manner that ensures that
-//there is a negligible probability that the same value will be
-//accidentally assigned to a different data object; if the application
-//uses multiple issuers, collisions MUST be prevented among values
-//produced by different issuers as well.The "jti" claim can be used
-//to prevent the JWT from being replayed.The "jti" value is a case-
-//sensitive string.
-
-// Define the Json string format for the JSON WEB TOKEN
-const char cstrJWTPayloadJson[] = "{\"jti\":\"%s-%08x-%08x\",\"iat\":%d}";
-
-// Define the Json string format for the button press data
-const char cstrButtonTelemetryJson[] = "{\"%s\":\"%d\"}";
-
-
-static const char cstrJWTHeaderJson[] = "{\"alg\":\"HS256\",\"typ\":\"JWT\"}";
 static char deviceId[200];
 static char key[200];
 
-// Set up a timer to return to main screen
-struct timespec gotoMainScreenPeriod = { 5, 0 };
-static const struct timespec nullPeriod = { 0, 0 };
+// Token mint context. Holds every buffer needed to mint a token and its QR code
+static iwt_token_ctx_t tokenCtx;
+
+// Delay before returning to main screen
+#define GOTO_MAIN_SCREEN_DELAY_MS 5000
 
 
 #define JSON_BUFFER_SIZE 204
 static long lastJwtId;
 
+// Screens of the e-paper display
+typedef enum {
+	SCREEN_IDLE,
+	SCREEN_BIN_BATTERY,
+	SCREEN_MESSAGES,
+	SCREEN_CLOCK,
+	SCREEN_QR
+} screen_t;
+
 // Support functions.
 static void TerminationHandler(int signalNumber);
 
-static int paintScreen(int (*paint)(void));
+static int paintScreen(screen_t screen);
+static void requestScreen(screen_t screen);
 
 static int InitPeripheralsAndHandlers(void);
 static void ClosePeripheralsAndHandlers(void);
 
 static void getTimeUtc(char* displayTimeBuffer);
-static void ButtonTimerEventHandler(EventData* eventData);
-static void GotoMainScreenTimerEventHandler(EventData* eventData);
+static void InputEventHandler(int input, iwt_input_event_t event);
+static void GotoMainScreenTimerHandler(Timer* timer);
+static void StatsTimerHandler(Timer* timer);
+static void NetworkChangedHandler(const iwt_network_state_t* state, unsigned int changes);
+#ifdef VCNL4040_PROXIMITY_INCLUDED
+static int InitFillLevel(void);
+static void updateProximityWindow(void);
+static void ProximityChangedHandler(uint16_t count);
+static void FillLevelChangedHandler(int level, int percent);
+static void DeviceTwinUpdatedHandler(JSON_Object* desiredProperties);
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
+static int SampleFillLevel(void);
+static bool SendTelemetry(const char* message);
+static void configureFillLevelTelemetry(void);
+#endif
+#endif
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
+static void AzureIoTTimerHandler(Timer* timer);
+static void AzureIoTWorkRequestedHandler(void);
+static void AzureIoTConnectionStatusHandler(bool connected);
+static void reportNetworkToDeviceTwin(const iwt_network_state_t* state);
+#endif
+static void EpaperRefreshedHandler(int result);
 
 
-// Button state variables, initilize them to button not-pressed (High)
-static GPIO_Value_Type buttonAState = GPIO_Value_High;
-static GPIO_Value_Type buttonBState = GPIO_Value_High;
+// Debounced buttons and reed switch, and their input indexes
+static iwt_input_t inputs;
+static int buttonAInput = -1;
+static int buttonBInput = -1;
+static int reedSwitchInput = -1;
 static SpiMasterConfigType spiMasterConfig;
+static iwt_epaper_t epaper;
+static iwt_render_t render;
+
+// Rendered screens, and the key of the frame last sent to the panel
+static iwt_frame_cache_t frameCache;
+static bool shownKeyValid = false;
+static uint32_t shownKey;
+
+// Inputs sampled with the screen key, the screens are painted from them
+static int binLevel;
+static time_t screenTime;
 
 #if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
 bool versionStringSent = false;
+static bool hubConnected = false;
+#endif
+static const char* versionString = "";
+
+// Housekeeping periods, out of the event loop
+#define STATS_PERIOD_MS 60000
+// FillLevel telemetry sample period, a message only goes out past the deadband or heartbeat
+#define FILL_LEVEL_TELEMETRY_PERIOD_MS 60000
+// Bounds of the FillLevel telemetry settings of the device twin: deadband in percent points,
+// heartbeat in minutes, from the sample period to a day
+#define FILL_LEVEL_DEADBAND_MAX 100
+#define FILL_LEVEL_HEARTBEAT_MAX_MINUTES (24 * 60)
+
+// Wi-Fi network monitor
+static iwt_network_t network;
+
+#ifdef VCNL4040_PROXIMITY_INCLUDED
+// Bin fill level: the proximity sensor thresholds wake the estimator up, it filters the counts
+static iwt_proximity_t proximity;
+static iwt_fill_level_t fillLevel;
+// false if the sensor did not start, the app then runs without the fill level services
+static bool proximityAvailable = false;
+// Calibration of the estimator, set from the device twin
+extern int binEmptyCount;
+extern int binFullCount;
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
+// FillLevel telemetry, its deadband and heartbeat are set from the device twin
+static iwt_telemetry_t fillLevelTelemetry;
+extern int fillLevelDeadband;
+extern int fillLevelHeartbeatMinutes;
 #endif
+#ifdef VCNL4040_INT_GPIO
+static int proximityIntGpioFd = -1;
+#endif
+#endif // VCNL4040_PROXIMITY_INCLUDED
 
 // Termination state
 static volatile sig_atomic_t terminationRequired = false;
 
-// event handler data structures. Only the event handler field needs to be populated.
-static EventData buttonEventData = { .eventHandler = &ButtonTimerEventHandler };
-
-// event handler data structures. Only the event handler field needs to be populated.
-static EventData gotoMainScreenEventData = { .eventHandler = &GotoMainScreenTimerEventHandler };
+// Timers of the timer wheel. Only the handler field needs to be populated.
+static Timer gotoMainScreenTimer = { .handler = &GotoMainScreenTimerHandler };
+static Timer statsTimer = { .handler = &StatsTimerHandler };
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
+static Timer azureIoTTimer = { .handler = &AzureIoTTimerHandler };
+#endif
 
 /// <summary>
 ///     Signal handler for termination requests. This handler must be async-signal-safe.
@@ -247,33 +313,13 @@ int paintIdleScreen(void) {
 	return 0;
 }
 
+
 /// <summary>
 ///     Paint battery screen. Asks for pressing A Button
 /// </summary>
 int paintBinBatteryScreen(void) {
 #ifdef VCNL4040_PROXIMITY_INCLUDED
-	int16_t distance = vcnl4040_getProximity();
-	distance = vcnl4040_getProximity();
-	Log_Debug("Distance: (%d).\n", distance);
-	int level;
-	if (distance <= 1) { // full
-		level = 5;
-	}
-	else if (distance > 1 && distance <= 10) {
-		level = 4;
-	}
-	else if (distance > 10 && distance <= 80) {
-		level = 3;
-	}
-	else if (distance > 80 && distance <= 120) { // full
-		level = 2;
-	}
-	else if (distance > 120 && distance <= 200) { // full
-		level = 1;
-	}
-	else if (distance > 200) { // empty
-		level = 0;
-	}
+	int level = binLevel;
 	Paint_DrawBitMap(gImage_BinBattery);
 	const int xorigin = 65;
 	const int xend = EPD_WIDTH - xorigin;
@@ -292,7 +338,7 @@ int paintClockScreen(void) {
 	char outstr[200];
 	timer_t t;
 	struct tm* tmp;
-	t = time(NULL);
+	t = screenTime;
 	tmp = localtime(&t);
 	if (tmp == NULL) {
 		Log_Debug("PaintClockScreen localtime returned NULL");
@@ -339,152 +385,185 @@ int paintMessagesScreen(void) {
 /// </summary>
 /// <returns>0 on success, or -1 on failure< / returns>
 int paintQrScreen(void) {
-	long unixTime = getUnixTime();
-
-	int jwtUid = rand();
-	char* jwebPayload = (char*)malloc(BUFFER_SIZE * sizeof(char));
-	if (jwebPayload == NULL) {
-		Log_Debug("Failed to apply jwebPayload memory...\r\n");
-		return -1;
-	}
-	sprintf(jwebPayload, cstrJWTPayloadJson, deviceId, jwtUid, unixTime, unixTime);
-	lastJwtId = jwtUid;
-
-	char* jwebPayloadBase64 = (char*)malloc(BUFFER_SIZE * sizeof(char));
-	if (jwebPayloadBase64 == NULL) {
-		Log_Debug("Failed to apply jwebPayloadBase64 memory...\r\n");
+	const iwt_token_t* token = iwt_token_ring_take(&tokenCtx, getUnixTime());
+	if (token == NULL) {
 		return -1;
 	}
-	jwt_urlsafe_base64_encode(jwebPayloadBase64, jwebPayload, strlen(jwebPayload));
+	lastJwtId = token->jti;
+	const uint8_t* qrcode = token->qrcode;
+
+	char displayTimeBuffer[26];
+	getTimeUtc(displayTimeBuffer);
+	displayTimeBuffer[24] = '\0';
+	sFONT headerFont = Font12;
+	int size = qrcodegen_getSize(qrcode);
+	int boxSize = (EPD_WIDTH - (4 * headerFont.Height)) / size;
+	int border = boxSize + (EPD_WIDTH - boxSize * size) / 2;
+
+	Paint_DrawRectangle(1, 1, EPD_WIDTH, EPD_HEIGHT, BLACK, DRAW_FILL_FULL, DOT_STYLE_DFT);
+	Paint_DrawRectangle(border- 2*boxSize, border - 2*boxSize,
+		size * boxSize + border + 2 * boxSize -1,
+		size * boxSize + border + 2 * boxSize -1, WHITE, DRAW_FILL_FULL, DOT_STYLE_DFT);
+	Paint_DrawString_EN((EPD_WIDTH - (24 * headerFont.Width)) / 2, headerFont.Height / 2, displayTimeBuffer, &Font12, BLACK, WHITE);
+	Paint_DrawString_EN((EPD_WIDTH - (11 * headerFont.Width)) / 2, EPD_HEIGHT - (headerFont.Height + headerFont.Height / 2), "I Was There", &Font12, BLACK, WHITE);
+
+	// Same module grid as drawing each module with Paint_DrawPoint(x * boxSize + border, ...),
+	// which centers a (2 * boxSize - 1) square dot one box up and left of that point
+	Paint_DrawQrCode(border - boxSize, border - boxSize, qrcode, boxSize);
+	return 0;
+}
 
-	free(jwebPayload);
-	
-	char* jwebHeaderTokenBase64 = (char*)malloc(BUFFER_SIZE * sizeof(char));
-	if (jwebHeaderTokenBase64 == NULL) {
-		Log_Debug("Failed to apply jwebHeaderTokenBase64 memory...\r\n");
-		return -1;
-	}
-	jwt_urlsafe_base64_encode(jwebHeaderTokenBase64, cstrJWTHeaderJson, strlen(cstrJWTHeaderJson));
+/// <summary>
+///     Idle work: refill the ring of pre-minted tokens after a take, one token per call,
+///     so that a press only has to stamp and render the QR screen.
+/// </summary>
+/// <returns>true while the ring has room for more tokens</returns>
+static bool MintTokensWhenIdle(void) {
+	return iwt_token_ring_refill(&tokenCtx, getUnixTime());
+}
 
-	char* jwebtoken = (char*)malloc(BUFFER_SIZE * sizeof(char));
-	if (jwebtoken == NULL) {
-		Log_Debug("Failed to apply jwebtoken memory...\r\n");
-		return -1;
-	}
-	sprintf(jwebtoken, "%s.%s", jwebHeaderTokenBase64, jwebPayloadBase64);
-	free(jwebPayloadBase64);
-	free(jwebHeaderTokenBase64);
+// Functions that paint each screen
+static int (*const screenPainters[])(void) = {
+	[SCREEN_IDLE] = paintIdleScreen,
+	[SCREEN_BIN_BATTERY] = paintBinBatteryScreen,
+	[SCREEN_MESSAGES] = paintMessagesScreen,
+	[SCREEN_CLOCK] = paintClockScreen,
+	[SCREEN_QR] = paintQrScreen
+};
 
-	char* jwebHmacBinary = (char*)malloc(BUFFER_SIZE * sizeof(char));
-	if (jwebHmacBinary == NULL) {
-		Log_Debug("Failed to apply jwebHmacBinary memory...\r\n");
-		return -1;
+/// <summary>
+///     Sample the inputs a screen is painted from and hash them into the frame cache key.
+///     The QR screen shows a new token every time and is never cached.
+/// </summary>
+/// <returns>true if the screen can be cached</returns>
+static bool getScreenKey(screen_t screen, uint32_t* key) {
+	uint32_t hash = iwt_frame_cache_hash(IWT_FRAME_CACHE_HASH_INIT, &screen, sizeof(screen));
+	switch (screen) {
+	case SCREEN_BIN_BATTERY:
+#ifdef VCNL4040_PROXIMITY_INCLUDED
+		if (proximityAvailable) {
+			binLevel = iwt_fill_level_level(&fillLevel);
+		}
+#endif
+		hash = iwt_frame_cache_hash(hash, &binLevel, sizeof(binLevel));
+		break;
+	case SCREEN_MESSAGES:
+		hash = iwt_frame_cache_hash(hash, oled_ms1, strnlen((const char*)oled_ms1, CLOUD_MSG_SIZE) + 1);
+		hash = iwt_frame_cache_hash(hash, oled_ms2, strnlen((const char*)oled_ms2, CLOUD_MSG_SIZE) + 1);
+		hash = iwt_frame_cache_hash(hash, oled_ms3, strnlen((const char*)oled_ms3, CLOUD_MSG_SIZE) + 1);
+		hash = iwt_frame_cache_hash(hash, oled_ms4, strnlen((const char*)oled_ms4, CLOUD_MSG_SIZE) + 1);
+		break;
+	case SCREEN_CLOCK: {
+		screenTime = time(NULL);
+		time_t minute = screenTime / 60;
+		hash = iwt_frame_cache_hash(hash, &minute, sizeof(minute));
+		break;
 	}
-	Log_Debug("WebToken: %s, Length: %d\n", jwebtoken, strlen(jwebtoken));
-	iwt_crypto_hmacsha256(jwebHmacBinary, jwebtoken, strlen(jwebtoken), key);
-
-	char* jwebHmacBase64 = (char*)malloc(BUFFER_SIZE * sizeof(char));
-	if (jwebHmacBase64 == NULL) {
-		Log_Debug("Failed to apply jwebHmacBase64 memory...\r\n");
-		return -1;
+	case SCREEN_QR:
+		return false;
+	default:
+		break;
 	}
-	jwt_urlsafe_base64_encode(jwebHmacBase64, jwebHmacBinary, SHA256_DIGEST_SIZE);
-	free(jwebHmacBinary);
+	*key = hash;
+	return true;
+}
 
-	char* jwebtokensigned = (char*)malloc(BUFFER_SIZE * sizeof(char));
-	if (jwebtokensigned == NULL) {
-		Log_Debug("Failed to apply jwebtokensigned memory...\r\n");
-		return -1;
+/// <summary>
+///     Generic method to paint a screen in the e-paper screen. A screen painted before from
+///     the same inputs comes from the frame cache, and nothing is sent if the panel already
+///     shows it.
+///     Inputs: The screen to paint
+/// </summary>
+/// <returns>0 on success, or -1 on failure< / returns>
+static int paintScreen(screen_t screen){
+	uint32_t key = 0;
+	bool cacheable = getScreenKey(screen, &key);
+	if (cacheable && shownKeyValid && key == shownKey) {
+		// The panel shows this frame, or is about to
+		return 0;
 	}
-	sprintf(jwebtokensigned, "%s.%s", jwebtoken, jwebHmacBase64);
-	free(jwebHmacBase64);
-	free(jwebtoken);
-		
-	enum qrcodegen_Ecc errCorLvl = qrcodegen_Ecc_LOW;  // Error correction level
 
-    // Make and print the QR Code symbol
-	uint8_t* qrcode = (uint8_t*) malloc(qrcodegen_BUFFER_LEN_MAX * sizeof(uint8_t));
-	if (qrcode == NULL) {
-		Log_Debug("Failed to apply qrcode memory...\r\n");
-		return -1;
+	int result = 0;
+	const UBYTE* frame = cacheable ? iwt_frame_cache_lookup(&frameCache, key) : NULL;
+	if (frame == NULL) {
+		// The display session owns the image cache
+		UBYTE* BlackImage = iwt_epaper_canvas(&epaper);
+		Paint_NewImage(BlackImage, EPD_WIDTH, EPD_HEIGHT, 0, BLACK);
+		Paint_Clear(WHITE);
+		result = screenPainters[screen]();
+		if (result == 0 && cacheable) {
+			iwt_frame_cache_store(&frameCache, key, BlackImage);
+		}
+		frame = BlackImage;
 	}
-	uint8_t* tempBuffer = (uint8_t*)malloc(qrcodegen_BUFFER_LEN_MAX * sizeof(uint8_t));
-	if (tempBuffer == NULL) {
-		Log_Debug("Failed to apply tempBuffer memory...\r\n");
-		return -1;
+	if (iwt_epaper_display(&epaper, frame) != 0) {
+		result = -1;
 	}
+	shownKeyValid = result == 0 && cacheable;
+	shownKey = key;
+	return result;
+}
 
-	bool ok = qrcodegen_encodeText(jwebtokensigned, tempBuffer, qrcode, errCorLvl,
-		qrcodegen_VERSION_MIN, qrcodegen_VERSION_MAX, qrcodegen_Mask_AUTO, true);
-	//Log_Debug("JWT Signed %s\n", jwebtokensigned);
-
-	free(jwebtokensigned);
-	
-	if (ok) {
-		char* displayTimeBuffer= (char*)malloc(26 * sizeof(char));
-		if (displayTimeBuffer == NULL) {
-			Log_Debug("Failed to apply displayTimeBuffer memory...\r\n");
-			return -1;
-		}
-		getTimeUtc(displayTimeBuffer);
-		displayTimeBuffer[24] = '\0';
-		sFONT headerFont = Font12;
-		int size = qrcodegen_getSize(qrcode);
-		int boxSize = (EPD_WIDTH - (4 * headerFont.Height)) / size;
-		int border = boxSize + (EPD_WIDTH - boxSize * size) / 2;
-
-		Paint_DrawRectangle(1, 1, EPD_WIDTH, EPD_HEIGHT, BLACK, DRAW_FILL_FULL, DOT_STYLE_DFT);
-		Paint_DrawRectangle(border- 2*boxSize, border - 2*boxSize,
-			size * boxSize + border + 2 * boxSize -1,
-			size * boxSize + border + 2 * boxSize -1, WHITE, DRAW_FILL_FULL, DOT_STYLE_DFT);
-		Paint_DrawString_EN((EPD_WIDTH - (24 * headerFont.Width)) / 2, headerFont.Height / 2, displayTimeBuffer, &Font12, BLACK, WHITE);
-		free(displayTimeBuffer);
-		Paint_DrawString_EN((EPD_WIDTH - (11 * headerFont.Width)) / 2, EPD_HEIGHT - (headerFont.Height + headerFont.Height / 2), "I Was There", &Font12, BLACK, WHITE);
-
-		for (int y = 0; y < size; y++) {
-			for (int x = 0; x < size; x++) {
-				if (qrcodegen_getModule(qrcode, x, y)) {
-					Paint_DrawPoint(x * boxSize + border, y * boxSize + border, BLACK, boxSize, DOT_STYLE_DFT);
-				}
-				else {
-					Paint_DrawPoint(x * boxSize + border, y * boxSize + border, WHITE, boxSize, DOT_STYLE_DFT);
-				}
-			}
-		}
-		free(qrcode);
-		free(tempBuffer);
-	}
-	return 0;
+/// <summary>
+///     Send the jti of the QR code on screen to the IoT Hub. The jti goes into the buttonA
+///     list of the batch with the QR codes issued in the next few seconds, a busy bin sends
+///     one message per burst: {"buttonA":["jti","jti",...]}.
+/// </summary>
+static void sendButtonATelemetry(void)
+{
+	char jsonBuffer[JSON_BUFFER_SIZE];
+	// construct the telemetry message  for Button A
+	snprintf(jsonBuffer, sizeof(jsonBuffer), cstrButtonTelemetryJson, lastJwtId);
+	Log_Debug("\n[Info] Queueing telemetry buttonA %s\n", jsonBuffer);
+	AzureIoT_QueueTelemetryItem("buttonA", jsonBuffer, AzureIoT_TelemetryUrgency_Prompt);
 }
 
 /// <summary>
-///     Generic method to paint a screen in the e-paper screen
-///     Inputs: The function that paints the screen
+///     Called by the render scheduler when a screen may go to the panel. Once a QR code
+///     is painted its token is reported and the idle screen comes back after a while.
 /// </summary>
 /// <returns>0 on success, or -1 on failure< / returns>
-static int paintScreen(int (*paint)(void) ){
-	if (EPD_Init(LUT_FULL_UPDATE(), &spiMasterConfig) != 0) {
-		Log_Debug("e-Paper init failed\r\n");
-		return -1;
-	}
-	//Create a new image cache
-	UBYTE* BlackImage;
-	/* you have to edit the startup_stm32fxxx.s file and set a big enough heap size */
-	UWORD Imagesize = ((EPD_WIDTH % 8 == 0) ? (EPD_WIDTH / 8) : (EPD_WIDTH / 8 + 1)) * EPD_HEIGHT;
-	if ((BlackImage = (UBYTE*)malloc(Imagesize)) == NULL) {
-		Log_Debug("Failed to apply for black memory...\r\n");
-		return -1;
+static int renderScreen(int screen)
+{
+	int result = paintScreen((screen_t)screen);
+	if (screen == SCREEN_QR && result == 0) {
+		sendButtonATelemetry();
+		// Set timer to return to idle screen
+		ArmTimer(&gotoMainScreenTimer, GOTO_MAIN_SCREEN_DELAY_MS, 0);
 	}
-	Paint_NewImage(BlackImage, EPD_WIDTH, EPD_HEIGHT, 0, BLACK);
-	Paint_Clear(WHITE);
-	int result = (*paint)();
-	EPD_Display(BlackImage);
-	free(BlackImage);
-	BlackImage = NULL;
-	EPD_Sleep();
 	return result;
 }
 
+/// <summary>
+///     Ask the render scheduler for a screen. A QR code preempts the clock, which
+///     preempts the messages and the battery level, which preempt the idle screen.
+/// </summary>
+static void requestScreen(screen_t screen)
+{
+	static const int priorities[] = {
+		[SCREEN_IDLE] = 0,
+		[SCREEN_BIN_BATTERY] = 1,
+		[SCREEN_MESSAGES] = 1,
+		[SCREEN_CLOCK] = 2,
+		[SCREEN_QR] = 3
+	};
+	iwt_render_request(&render, screen, priorities[screen]);
+}
+
+/// <summary>
+///     Called when the e-paper refresh started by paintScreen is over.
+///     The panel stays awake for a while, in case another screen follows.
+/// </summary>
+static void EpaperRefreshedHandler(int result)
+{
+	if (result != 0) {
+		Log_Debug("ERROR: e-Paper refresh failed\n");
+		// The panel content is unknown, paint the next screen again
+		shownKeyValid = false;
+	}
+	iwt_render_refreshed(&render);
+}
+
 
 /// <summary>
 ///     Set up SIGTERM termination handler, initialize peripherals, and set up event handlers.
@@ -502,6 +581,11 @@ static int InitPeripheralsAndHandlers(void)
         return -1;
     }
 
+	// Every timer of the application runs on the wheel, a single timerfd in the epoll
+	if (CreateTimerWheel(epollFd) != 0) {
+		return -1;
+	}
+
 	// Open button A GPIO as input
 	Log_Debug("Opening Starter Kit Button A as input.\n");
 	buttonAGpioFd = GPIO_OpenAsInput(MT3620_RDB_BUTTON_A);
@@ -531,19 +615,34 @@ static int InitPeripheralsAndHandlers(void)
 		return -1;
 	}
 
-	// Set up a timer to poll the buttons
-	struct timespec buttonPressCheckPeriod = { 0, 1000000 };
-	buttonPollTimerFd =
-		CreateTimerFdAndAddToEpoll(epollFd, &buttonPressCheckPeriod, &buttonEventData, EPOLLIN);
-	if (buttonPollTimerFd < 0) {
+	// Set up the debounced polling of the buttons and the reed switch
+	// The buttons have GPIO_Value_Low when pressed, the reed switch when closed
+	if (iwt_input_init(&inputs, &InputEventHandler) != 0) {
+		return -1;
+	}
+	buttonAInput = iwt_input_add(&inputs, buttonAGpioFd, GPIO_Value_Low, IWT_INPUT_BUTTON_DEBOUNCE_MS);
+	buttonBInput = iwt_input_add(&inputs, buttonBGpioFd, GPIO_Value_Low, IWT_INPUT_BUTTON_DEBOUNCE_MS);
+	if (buttonAInput < 0 || buttonBInput < 0) {
 		return -1;
 	}
+#ifdef REED_SWITCH_INCLUDED
+	reedSwitchInput = iwt_input_add(&inputs, reedSwitchFd, GPIO_Value_Low, IWT_INPUT_REED_DEBOUNCE_MS);
+	if (reedSwitchInput < 0) {
+		return -1;
+	}
+#endif // REED_SWITCH_INCLUDED
 
-	gotoMainScreenTimerFd =
-		CreateTimerFdAndAddToEpoll(epollFd, &nullPeriod, &gotoMainScreenEventData, EPOLLIN);
-	if (gotoMainScreenTimerFd < 0) {
+	// Housekeeping runs on its own timers, not after every event
+	if (iwt_network_init(&network, &NetworkChangedHandler) != 0) {
 		return -1;
 	}
+	ArmTimer(&statsTimer, STATS_PERIOD_MS, STATS_PERIOD_MS);
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
+	// IoT Hub servicing adapts its cadence to the work in flight, see AzureIoTTimerHandler
+	AzureIoT_SetWorkRequestedCallback(&AzureIoTWorkRequestedHandler);
+	AzureIoT_SetConnectionStatusCallback(&AzureIoTConnectionStatusHandler);
+	ArmTimer(&azureIoTTimer, AZURE_IOT_DOWORK_FAST_MS, 0);
+#endif
 	
 	epaperSpiBusyFd = GPIO_OpenAsInput(SAMPLE_EPAPER_BUSY);
 	if (epaperSpiBusyFd < 0) {
@@ -606,9 +705,10 @@ static int InitPeripheralsAndHandlers(void)
 	spiMasterConfig.dcFd = epaperSpiDcFd;
 	spiMasterConfig.resetFd = epaperSpiResetFd;
 	spiMasterConfig.busyFd = epaperSpiBusyFd;
-
-	if (EPD_Init(LUT_FULL_UPDATE(), &spiMasterConfig) != 0) {
-		Log_Debug("e-Paper init failed\r\n");
+	if (iwt_epaper_init(&epaper, &spiMasterConfig, IWT_EPAPER_PARTIAL_REFRESH_MAX, &EpaperRefreshedHandler) != 0) {
+		return -1;
+	}
+	if (iwt_render_init(&render, &epaper, &renderScreen, IWT_RENDER_MIN_DWELL_MS) != 0) {
 		return -1;
 	}
 
@@ -631,14 +731,17 @@ static int InitPeripheralsAndHandlers(void)
 	}
 
 	// Tell the system about the callback function that gets called when we receive a device twin update message from Azure
+#ifdef VCNL4040_PROXIMITY_INCLUDED
+	AzureIoT_SetDeviceTwinUpdateCallback(&DeviceTwinUpdatedHandler);
+#else
 	AzureIoT_SetDeviceTwinUpdateCallback(&deviceTwinChangedHandler);
+#endif
 
 #ifdef VCNL4040_PROXIMITY_INCLUDED
-	if (vcnl4040_begin(VCNL4040_ISU) == -1) {
-		return -1;
+	proximityAvailable = (InitFillLevel() == 0);
+	if (!proximityAvailable) {
+		Log_Debug("ERROR: Proximity sensor not available, running without the bin fill level.\n");
 	}
-	int16_t distance = vcnl4040_getProximity();
-	Log_Debug("Distance: (%d).\n", distance);
 #endif
 
     return 0;
@@ -646,164 +749,337 @@ static int InitPeripheralsAndHandlers(void)
 
 
 /// <summary>
-///     Handle button timer event: 
-///		if the A button is pressed print QR on screen.
-///		if the B button is pressed print idle screen.
+///     Handle debounced input events: 
+///		if the reed switch closes or the A button is released print a new QR on screen.
+///		if the reed switch opens print the messages or the bin level.
+///		if the A button is pressed print the messages, if any.
+///		if the B button is pressed print the clock, if it is held go back to the idle screen.
 /// </summary>
-static void ButtonTimerEventHandler(EventData* eventData)
+static void InputEventHandler(int input, iwt_input_event_t event)
 {
-	bool sendTelemetryButtonA;
-
-	if (ConsumeTimerFdEvent(buttonPollTimerFd) != 0) {
-		terminationRequired = true;
-		return;
-	}
-
-	int result;
-
-	//int16_t distance = proximity_get();
-	//Log_Debug("Distance: (%d).\n", distance);
-
-
-
-
-#ifdef REED_SWITCH_INCLUDED
-	// Check for reed switch open
-	GPIO_Value_Type newReedSwitchState;
-	result = GPIO_GetValue(reedSwitchFd, &newReedSwitchState);
-	if (result != 0) {
-		Log_Debug("ERROR: Could not read Reed Switch GPIO: %s (%d).\n", strerror(errno), errno);
-		terminationRequired = true;
-		return;
-	}
-	if (newReedSwitchState != reedSwitchState) {
-		if (reedSwitchState == GPIO_Value_Low) {
-
+	if (input == reedSwitchInput) {
+		if (event == IWT_INPUT_RELEASE) {
 			Log_Debug("Reed Switch opened!\n");
 			// check if there is a message to show
 			if (strlen(oled_ms1) > 0) {
-				paintScreen(paintMessagesScreen);
+				requestScreen(SCREEN_MESSAGES);
 			}
 			else {
-				paintScreen(paintBinBatteryScreen);
+				requestScreen(SCREEN_BIN_BATTERY);
 			}
-
-
 		}
-		else {
+		else if (event == IWT_INPUT_PRESS) {
 			Log_Debug("Reed Switch A closed!\n");
-			paintScreen(paintQrScreen);
-			sendTelemetryButtonA = true;
+			requestScreen(SCREEN_QR);
+		}
+	}
+	else if (input == buttonAInput) {
+		if (event == IWT_INPUT_PRESS) {
+			Log_Debug("Button A pressed!\n");
+			// check if there is a message to show
+			if (strlen(oled_ms1) > 0) {
+				requestScreen(SCREEN_MESSAGES);
+			}
+		}
+		else if (event == IWT_INPUT_RELEASE) {
+			Log_Debug("Button A released!\n");
+			requestScreen(SCREEN_QR);
+		}
+	}
+	else if (input == buttonBInput) {
+		if (event == IWT_INPUT_PRESS) {
+#ifdef VCNL4040_PROXIMITY_INCLUDED
+			if (proximityAvailable) {
+				Log_Debug("Bin level: %d (%d%%).\n", iwt_fill_level_level(&fillLevel), iwt_fill_level_percent(&fillLevel));
+			}
+#endif // VCNL4040_PROXIMITY_INCLUDED
+			Log_Debug("Button B pressed!\n");
+			requestScreen(SCREEN_CLOCK);
+		}
+		else if (event == IWT_INPUT_LONG_PRESS) {
+			Log_Debug("Button B held!\n");
+			requestScreen(SCREEN_IDLE);
+		}
+		else {
+			Log_Debug("Button B released!\n");
 			// Set timer to return to idle screen
-			SetTimerFdToSingleExpiry(gotoMainScreenTimerFd, &gotoMainScreenPeriod);
+			ArmTimer(&gotoMainScreenTimer, GOTO_MAIN_SCREEN_DELAY_MS, 0);
 		}
-		// Update the static variable to use next time we enter this routine
-		reedSwitchState = newReedSwitchState;
 	}
+}
 
 
-#endif // REED_SWITCH_INCLUDED
+/// <summary>
+///     Handle button timer event: if the button is pressed, report the event to the IoT Hub.
+/// </summary>
+static void GotoMainScreenTimerHandler(Timer* timer)
+{
+	Log_Debug("GotoMainScreenTimerHandler");
+	requestScreen(SCREEN_IDLE);
 
+}
 
-	// Check for button A press
-	GPIO_Value_Type newButtonAState;
-	result = GPIO_GetValue(buttonAGpioFd, &newButtonAState);
-	if (result != 0) {
-		Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n", strerror(errno), errno);
-		terminationRequired = true;
+
+
+/// <summary>
+///     The Wi-Fi network changed: keep it for the display and report it to the device twin.
+/// </summary>
+static void NetworkChangedHandler(const iwt_network_state_t* state, unsigned int changes)
+{
+	memset(network_data.SSID, 0, WIFICONFIG_SSID_MAX_LENGTH);
+	if (!state->connected)
+	{
+		Log_Debug("INFO: Not currently connected to a WiFi network.\n");
+		strncpy((char*)network_data.SSID, "Not Connected", SSID_MAX_LEGTH);
+		network_data.frequency_MHz = 0;
+		network_data.rssi = 0;
 		return;
 	}
+	strncpy((char*)network_data.SSID, state->ssid, SSID_MAX_LEGTH);
+	network_data.frequency_MHz = state->frequencyMHz;
+	network_data.rssi = state->rssi;
 
-	// If the A button has just been pressed, print a new JWT QR on screen
-	// The button has GPIO_Value_Low when pressed and GPIO_Value_High when released
-	if (newButtonAState != buttonAState) {
-		if (newButtonAState == GPIO_Value_Low) {
+	// A new RSSI bucket alone only matters to the display
+	if ((changes & ~IWT_NETWORK_RSSI_CHANGED) == 0) {
+		return;
+	}
+	Log_Debug("SSID: %s\n", state->ssid);
+	Log_Debug("Frequency: %dMHz\n", state->frequencyMHz);
 
-			Log_Debug("Button A pressed!\n");
-			// check if there is a message to show
-			if (strlen(oled_ms1) > 0) { 
-				paintScreen(paintMessagesScreen);
-			}
-			
-		}
-		else {
-			Log_Debug("Button A released!\n");
-			paintScreen(paintQrScreen);
-			sendTelemetryButtonA = true;
-			// Set timer to return to idle screen
-			SetTimerFdToSingleExpiry(gotoMainScreenTimerFd, &gotoMainScreenPeriod);
-		}
-		// Update the static variable to use next time we enter this routine
-		buttonAState = newButtonAState;
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
+	// Until the IoT Hub client is connected the report waits, the connection sends the
+	// cached state
+	if (hubConnected) {
+		reportNetworkToDeviceTwin(state);
 	}
+#endif 
+}
 
-	// Check for button B press
-	GPIO_Value_Type newButtonBState;
-	result = GPIO_GetValue(buttonBGpioFd, &newButtonBState);
-	if (result != 0) {
-		Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n", strerror(errno), errno);
-		terminationRequired = true;
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
+/// <summary>
+///     Report the Wi-Fi network to the device twin.
+/// </summary>
+static void reportNetworkToDeviceTwin(const iwt_network_state_t* state)
+{
+	if (!state->connected) {
 		return;
 	}
+	uint32_t frequency = state->frequencyMHz;
+	char bssid[20];
+	snprintf(bssid, sizeof(bssid), "%02x:%02x:%02x:%02x:%02x:%02x",
+		state->bssid[0], state->bssid[1], state->bssid[2],
+		state->bssid[3], state->bssid[4], state->bssid[5]);
+	Log_Debug("bssid: %s\n", bssid);
+	// Note that we send up this data to Azure if it changes, but the IoT Central Properties elements only 
+	// show the data that was currenet when the device first connected to Azure.
+	checkAndUpdateDeviceTwin("ssid", (void*)state->ssid, TYPE_STRING, false);
+	checkAndUpdateDeviceTwin("freq", &frequency, TYPE_INT, false);
+	checkAndUpdateDeviceTwin("bssid", &bssid, TYPE_STRING, false);
+}
+
+/// <summary>
+///     The IoT Hub connection went up or down. On every connection the cached network
+///     state is reported, the changes seen while disconnected were not.
+/// </summary>
+static void AzureIoTConnectionStatusHandler(bool connected)
+{
+	hubConnected = connected;
+	if (connected) {
+		reportNetworkToDeviceTwin(iwt_network_state(&network));
+	}
+}
+#endif
 
-	// If the B button has just been pressed/released goto idle screen.TODO: Reset timer.
-	// The button has GPIO_Value_Low when pressed and GPIO_Value_High when released
-	if (newButtonBState != buttonBState) {
-		if (newButtonBState == GPIO_Value_Low) {
 #ifdef VCNL4040_PROXIMITY_INCLUDED
-			int16_t distance = vcnl4040_getProximity();
-			Log_Debug("Distance: (%d).\n", distance);
+/// <summary>
+///     Start the proximity sensor, the fill level estimator and the FillLevel telemetry.
+/// </summary>
+/// <returns>0 on success, -1 if the sensor can not be used</returns>
+static int InitFillLevel(void)
+{
+	if (!vcnl4040_begin(VCNL4040_ISU)) {
+		Log_Debug("ERROR: Could not configure the VCNL4040 sensor.\n");
+		return -1;
+	}
+	int intGpioFd = -1;
+#ifdef VCNL4040_INT_GPIO
+	proximityIntGpioFd = GPIO_OpenAsInput(VCNL4040_INT_GPIO);
+	if (proximityIntGpioFd < 0) {
+		Log_Debug("ERROR: Could not open proximity INT GPIO: %s (%d).\n", strerror(errno), errno);
+		return -1;
+	}
+	intGpioFd = proximityIntGpioFd;
+#endif
+	if (iwt_proximity_init(&proximity, intGpioFd, &ProximityChangedHandler) != 0) {
+		return -1;
+	}
+	if (iwt_fill_level_init(&fillLevel, &FillLevelChangedHandler) != 0) {
+		iwt_proximity_close(&proximity);
+		return -1;
+	}
+	iwt_fill_level_calibrate(&fillLevel, binEmptyCount, binFullCount);
+	binLevel = iwt_fill_level_level(&fillLevel);
+	updateProximityWindow();
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
+	if (iwt_telemetry_init(&fillLevelTelemetry, "FillLevel", FILL_LEVEL_TELEMETRY_PERIOD_MS, &SampleFillLevel, &SendTelemetry) != 0) {
+		iwt_fill_level_close(&fillLevel);
+		iwt_proximity_close(&proximity);
+		return -1;
+	}
+	configureFillLevelTelemetry();
+#endif
+	return 0;
+}
 
-#endif // VCNL4040_PROXIMITY_INCLUDED
-			Log_Debug("Button B pressed!\n");	
-			paintScreen(paintClockScreen);
+/// <summary>
+///     Narrow the proximity window to the counts of the current fill level, so the sensor
+///     interrupt follows the level and the calibration.
+/// </summary>
+static void updateProximityWindow(void)
+{
+	uint16_t low;
+	uint16_t high;
+	iwt_fill_level_window(&fillLevel, &low, &high);
+	iwt_proximity_set_window(&proximity, low, high);
+}
 
-		}
-		else {
-			Log_Debug("Button B released!\n");
-			// Set timer to return to idle screen
-			SetTimerFdToSingleExpiry(gotoMainScreenTimerFd, &gotoMainScreenPeriod);
-		}
-		// Update the static variable to use next time we enter this routine
-		buttonBState = newButtonBState;
-	}
-	// If either button was pressed, then enter the code to send the telemetry message
-	if (sendTelemetryButtonA ) {
+/// <summary>
+///     The proximity count left the window of the fill level: the level may be moving.
+/// </summary>
+static void ProximityChangedHandler(uint16_t count)
+{
+	iwt_fill_level_add_sample(&fillLevel, count);
+	iwt_fill_level_wake(&fillLevel);
+}
 
-		char* pjsonBuffer = (char*)malloc(JSON_BUFFER_SIZE);
-		if (pjsonBuffer == NULL) {
-			Log_Debug("ERROR: not enough memory to send telemetry");
-		}
+/// <summary>
+///     The filtered bin fill level changed.
+/// </summary>
+static void FillLevelChangedHandler(int level, int percent)
+{
+	Log_Debug("Bin level: %d (%d%%).\n", level, percent);
+	binLevel = level;
+	updateProximityWindow();
+}
 
-		if (sendTelemetryButtonA) {
-			// construct the telemetry message  for Button A
-			snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrButtonTelemetryJson, "buttonA", lastJwtId);
-			Log_Debug("\n[Info] Sending telemetry %s\n", pjsonBuffer);
-			AzureIoT_SendMessage(pjsonBuffer);
-		}
+/// <summary>
+///     Device twin update: apply the twin array, then the fill level calibration and the
+///     FillLevel telemetry settings.
+/// </summary>
+static void DeviceTwinUpdatedHandler(JSON_Object* desiredProperties)
+{
+	deviceTwinChangedHandler(desiredProperties);
+	if (!proximityAvailable) {
+		return;
+	}
+	iwt_fill_level_calibrate(&fillLevel, binEmptyCount, binFullCount);
+	updateProximityWindow();
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
+	configureFillLevelTelemetry();
+#endif
+}
 
-		free(pjsonBuffer);
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
+/// <summary>
+///     Apply the FillLevel telemetry settings of the device twin. Out of range values are
+///     rejected and the previous settings kept.
+/// </summary>
+static void configureFillLevelTelemetry(void)
+{
+	if (fillLevelDeadband < 1 || fillLevelDeadband > FILL_LEVEL_DEADBAND_MAX
+		|| fillLevelHeartbeatMinutes < FILL_LEVEL_TELEMETRY_PERIOD_MS / 60000
+		|| fillLevelHeartbeatMinutes > FILL_LEVEL_HEARTBEAT_MAX_MINUTES) {
+		Log_Debug("ERROR: FillLevel telemetry deadband %d or heartbeat %d minutes out of range.\n",
+			fillLevelDeadband, fillLevelHeartbeatMinutes);
+		return;
 	}
+	iwt_telemetry_configure(&fillLevelTelemetry, fillLevelDeadband, (uint32_t)fillLevelHeartbeatMinutes * 60000);
+}
 
+/// <summary>
+///     FillLevel telemetry sample: the cached fill estimate, in percent.
+/// </summary>
+static int SampleFillLevel(void)
+{
+	return iwt_fill_level_percent(&fillLevel);
 }
 
+/// <summary>
+///     Queue a telemetry message in the routine batch of the IoT Hub client.
+/// </summary>
+static bool SendTelemetry(const char* message)
+{
+	Log_Debug("[Info] Queueing telemetry %s\n", message);
+	return AzureIoT_QueueTelemetry(message, AzureIoT_TelemetryUrgency_Routine);
+}
+#endif
+#endif // VCNL4040_PROXIMITY_INCLUDED
 
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
 /// <summary>
-///     Handle button timer event: if the button is pressed, report the event to the IoT Hub.
+///     Azure IoT timer event: set up the IoT Hub client and keep the flow of data going.
 /// </summary>
-static void GotoMainScreenTimerEventHandler(EventData* eventData)
+static void AzureIoTTimerHandler(Timer* timer)
 {
-	Log_Debug("GotoMainScreenTimerEventHandler");
-	if (ConsumeTimerFdEvent(gotoMainScreenTimerFd) != 0) {
+	// Setup the IoT Hub client.
+	// Notes:
+	// - it is safe to call this function even if the client has already been set up, as in
+	//   this case it would have no effect;
+	// - a failure to setup the client is a fatal error.
+	if (!AzureIoT_SetupClient()) {
+		Log_Debug("ERROR: Failed to set up IoT Hub client\n");
 		terminationRequired = true;
 		return;
 	}
 
-	paintScreen(paintIdleScreen);
+	if (iothubClientHandle != NULL && !versionStringSent) {
 
+		checkAndUpdateDeviceTwin("versionString", (void*)versionString, TYPE_STRING, false);
+		versionStringSent = true;
+	}
+
+	// AzureIoT_DoPeriodicTasks() keeps active the flow of data with the Azure IoT Hub. It runs
+	// fast while the client connects or has work in flight, and backs off when idle
+	AzureIoT_DoPeriodicTasks();
+	ArmTimer(&azureIoTTimer, AzureIoT_GetDoWorkDelayMs(), 0);
 }
 
+/// <summary>
+///     A message or a reported property was handed to the IoT Hub client: service it now
+///     instead of waiting for the idle delay.
+/// </summary>
+static void AzureIoTWorkRequestedHandler(void)
+{
+	ArmTimer(&azureIoTTimer, 0, 0);
+}
+#endif
 
+/// <summary>
+///     Stats timer event: log where the event loop spends its time.
+/// </summary>
+static void StatsTimerHandler(Timer* timer)
+{
+	LogEventLoopStats();
+	LogEventHandlerStats(&inputs.timer.stats, "input");
+	LogEventHandlerStats(&epaper.timer.stats, "e-Paper");
+	LogEventHandlerStats(&render.timer.stats, "render");
+	LogEventHandlerStats(&gotoMainScreenTimer.stats, "gotoMainScreen");
+	LogEventHandlerStats(&network.timer.stats, "network");
+#ifdef VCNL4040_PROXIMITY_INCLUDED
+	if (proximityAvailable) {
+		LogEventHandlerStats(&proximity.timer.stats, "proximity");
+		LogEventHandlerStats(&fillLevel.timer.stats, "fillLevel");
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
+		LogEventHandlerStats(&fillLevelTelemetry.timer.stats, "fillLevelTelemetry");
+		Log_Debug("FillLevel telemetry: %u messages for %u samples.\n", fillLevelTelemetry.messages, fillLevelTelemetry.samples);
+#endif
+	}
+#endif
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
+	LogEventHandlerStats(&azureIoTTimer.stats, "azureIoT");
+#endif
+	LogEventHandlerStats(&statsTimer.stats, "stats");
+}
 
 /// <summary>
 ///     Main entry point for this application.
@@ -814,14 +1090,22 @@ int main(int argc, char *argv[])
 	strcpy(deviceId, argv[2]);
 	Log_Debug("Device ID: %s\n", deviceId);
 	strcpy(key, argv[3]);
-	// Variable to help us send the version string up only once
-	bool networkConfigSent = false;
-	char ssid[128];
-	uint32_t frequency;
-	char bssid[20];
-
-	// Clear the ssid array
-	memset(ssid, 0, 128);
+	// Optional short device index, used by the compact token profile
+	uint16_t deviceIndex = 0;
+	if (argc > 4) {
+		char* end;
+		errno = 0;
+		unsigned long index = strtoul(argv[4], &end, 10);
+		if (errno != 0 || end == argv[4] || *end != '\0' || argv[4][0] == '-' || index > UINT16_MAX) {
+			Log_Debug("ERROR: Invalid device index '%s', expected 0 to %u.\n", argv[4], UINT16_MAX);
+			terminationRequired = true;
+		}
+		deviceIndex = (uint16_t)index;
+	}
+	if (iwt_token_init(&tokenCtx, deviceId, deviceIndex, (const uint8_t*)key, (uint32_t)strlen(key)) != 0) {
+		terminationRequired = true;
+	}
+	versionString = argv[1];
     Log_Debug("EPAPER Sample application starting.\n");
 	if (InitPeripheralsAndHandlers() != 0) {
         terminationRequired = true;
@@ -829,97 +1113,14 @@ int main(int argc, char *argv[])
 	if (!terminationRequired) {
 		// Init random seed with current time
 		srand(getUnixTime() & 0xFFFFFFFF);
-		paintScreen(paintIdleScreen);
+		requestScreen(SCREEN_IDLE);
 	}
 
     // Use epoll to wait for events and trigger handlers, until an error or SIGTERM happens
     while (!terminationRequired) {
-        if (WaitForEventAndCallHandler(epollFd) != 0) {
+        if (WaitForEventOrRunIdleHandler(epollFd, &MintTokensWhenIdle) != 0) {
             terminationRequired = true;
         }
-
-
-#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
-		// Setup the IoT Hub client.
-		// Notes:
-		// - it is safe to call this function even if the client has already been set up, as in
-		//   this case it would have no effect;
-		// - a failure to setup the client is a fatal error.
-		if (!AzureIoT_SetupClient()) {
-			Log_Debug("ERROR: Failed to set up IoT Hub client\n");
-			break;
-		}
-#endif 
-
-		WifiConfig_ConnectedNetwork network;
-		int result = WifiConfig_GetCurrentNetwork(&network);
-
-		if (result < 0)
-		{
-			// Log_Debug("INFO: Not currently connected to a WiFi network.\n");
-			//// OLED
-			strncpy(network_data.SSID, "Not Connected", 20);
-
-			network_data.frequency_MHz = 0;
-
-			network_data.rssi = 0;
-		}
-		else
-		{
-
-			frequency = network.frequencyMHz;
-			snprintf(bssid, JSON_BUFFER_SIZE, "%02x:%02x:%02x:%02x:%02x:%02x",
-				network.bssid[0], network.bssid[1], network.bssid[2],
-				network.bssid[3], network.bssid[4], network.bssid[5]);
-
-			if ((strncmp(ssid, (char*)&network.ssid, network.ssidLength) != 0) || !networkConfigSent) {
-
-				memset(ssid, 0, 128);
-				strncpy(ssid, network.ssid, network.ssidLength);
-				Log_Debug("SSID: %s\n", ssid);
-				Log_Debug("Frequency: %dMHz\n", frequency);
-				Log_Debug("bssid: %s\n", bssid);
-				networkConfigSent = true;
-
-#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
-				// Note that we send up this data to Azure if it changes, but the IoT Central Properties elements only 
-				// show the data that was currenet when the device first connected to Azure.
-				checkAndUpdateDeviceTwin("ssid", &ssid, TYPE_STRING, false);
-				checkAndUpdateDeviceTwin("freq", &frequency, TYPE_INT, false);
-				checkAndUpdateDeviceTwin("bssid", &bssid, TYPE_STRING, false);
-#endif 
-			}
-
-			//// OLED
-
-			memset(network_data.SSID, 0, WIFICONFIG_SSID_MAX_LENGTH);
-			if (network.ssidLength <= SSID_MAX_LEGTH)
-			{
-				strncpy(network_data.SSID, network.ssid, network.ssidLength);
-			}
-			else
-			{
-				strncpy(network_data.SSID, network.ssid, SSID_MAX_LEGTH);
-			}
-
-			network_data.frequency_MHz = network.frequencyMHz;
-
-			network_data.rssi = network.signalRssi;
-		}
-#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
-		if (iothubClientHandle != NULL && !versionStringSent) {
-
-			checkAndUpdateDeviceTwin("versionString", argv[1], TYPE_STRING, false);
-			versionStringSent = true;
-		}
-
-		// AzureIoT_DoPeriodicTasks() needs to be called frequently in order to keep active
-		// the flow of data with the Azure IoT Hub
-		AzureIoT_DoPeriodicTasks();
-#endif
-
-
-
     }
 
     ClosePeripheralsAndHandlers();
@@ -933,17 +1134,28 @@ int main(int argc, char *argv[])
 /// </summary>
 static void ClosePeripheralsAndHandlers(void)
 {
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
+	// Hand the telemetry still waiting in a batch over to the client and give it a chance to go
+	if (iothubClientHandle != NULL) {
+		AzureIoT_FlushTelemetry();
+		AzureIoT_DoPeriodicTasks();
+	}
+#endif
+
 	Log_Debug("Closing file descriptors.\n");
+	iwt_render_close(&render);
+	iwt_epaper_close(&epaper);
 	CloseFdAndPrintError(spiFd, "Spi");
 	CloseFdAndPrintError(epaperSpiBusyFd, "Spi Busy");
 	CloseFdAndPrintError(epaperSpiDcFd, "Spi DC");
 	CloseFdAndPrintError(epaperSpiResetFd, "Spi Reset");
 	CloseFdAndPrintError(epollFd, "Epoll");
 
-	CloseFdAndPrintError(buttonPollTimerFd, "buttonPoll");
+	iwt_input_close(&inputs);
+	iwt_network_close(&network);
 	CloseFdAndPrintError(buttonAGpioFd, "buttonA");
 	CloseFdAndPrintError(buttonBGpioFd, "buttonB");
-	CloseFdAndPrintError(gotoMainScreenTimerFd, "gotoMainScreen");
+	CloseTimerWheel();
 	for (int i = 0; i < twinArraySize; i++) {
 		if (twinArray[i].twinGPIO != NO_GPIO_ASSOCIATED_WITH_TWIN) {
 			CloseFdAndPrintError(*twinArray[i].twinFd, "twinArray");
@@ -954,7 +1166,17 @@ static void ClosePeripheralsAndHandlers(void)
 #endif // REED_SWITCH_INCLUDED
 
 #ifdef VCNL4040_PROXIMITY_INCLUDED
+	if (proximityAvailable) {
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
+		iwt_telemetry_close(&fillLevelTelemetry);
+#endif
+		iwt_fill_level_close(&fillLevel);
+		iwt_proximity_close(&proximity);
+	}
 	vcnl4040_closeI2c();
+#ifdef VCNL4040_INT_GPIO
+	CloseFdAndPrintError(proximityIntGpioFd, "ProximityInt");
+#endif
 #endif
 
 
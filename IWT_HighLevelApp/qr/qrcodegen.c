@@ -27,6 +27,26 @@
 #include <string.h>
 #include "qrcodegen.h"
 
+#ifdef QRCODEGEN_HOST_THREADS
+	#include <pthread.h>
+#endif
+
+#define qrcodegen_SIZE_MAX (qrcodegen_VERSION_MAX * 4 + 17)
+#define qrcodegen_ROW_WORDS ((qrcodegen_SIZE_MAX + 31) / 32)  // Words per row of a grid packed by rows
+
+// Scratch of getPenaltyScore(): the modules packed by rows and packed by columns, about 4 KiB each.
+struct PenaltyGrids {
+	uint32_t rows[qrcodegen_SIZE_MAX][qrcodegen_ROW_WORDS];
+	uint32_t columns[qrcodegen_SIZE_MAX][qrcodegen_ROW_WORDS];
+};
+
+// The layout of the last version encoded is cached if it is not above this version, see drawLayout().
+// Costs 2 bytes per module plus two grids, about 21 KiB for version 20. Off by default (0): define it
+// where the RAM is available and the same version is encoded over and over.
+#ifndef qrcodegen_LAYOUT_CACHE_VERSION_MAX
+	#define qrcodegen_LAYOUT_CACHE_VERSION_MAX 0
+#endif
+
 #ifndef QRCODEGEN_TEST
 	#define testable static  // Keep functions private
 #else
@@ -40,7 +60,9 @@
 // - They require all pointer/array arguments to be not null unless the array length is zero.
 // - They only read input scalar/array arguments, write to output pointer/array
 //   arguments, and return scalar values; they are "pure" functions.
-// - They don't read mutable global variables or write to any global variables.
+// - They don't read mutable global variables or write to any global variables,
+//   except the layout cache of the last version encoded (see drawLayout())
+//   and the static scratch grids of the mask choice (see chooseMask()).
 // - They don't perform I/O, read the clock, print to console, etc.
 // - They allocate a small and constant amount of stack memory.
 // - They don't allocate or free any memory on the heap.
@@ -50,7 +72,11 @@
 //   Most functions run in linear time, and some in constant time.
 //   There are no unbounded loops or non-obvious termination conditions.
 // - They are completely thread-safe if the caller does not give the
-//   same writable buffer to concurrent calls to these functions.
+//   same writable buffer to concurrent calls to these functions, and
+//   QRCODEGEN_HOST_THREADS is defined (the layout cache and the scratch grids
+//   are then locked).
+// - They don't start threads, unless QRCODEGEN_HOST_THREADS is defined: then
+//   the automatic mask choice scores the 8 masks in parallel (POSIX threads).
 
 testable void appendBitsToBuffer(unsigned int val, int numBits, uint8_t buffer[], int *bitLen);
 
@@ -58,20 +84,29 @@ testable void addEccAndInterleave(uint8_t data[], int version, enum qrcodegen_Ec
 testable int getNumDataCodewords(int version, enum qrcodegen_Ecc ecl);
 testable int getNumRawDataModules(int ver);
 
-testable void reedSolomonComputeDivisor(int degree, uint8_t result[]);
+testable const uint8_t *reedSolomonGetDivisor(int degree);
 testable void reedSolomonComputeRemainder(const uint8_t data[], int dataLen,
 	const uint8_t generator[], int degree, uint8_t result[]);
-testable uint8_t reedSolomonMultiply(uint8_t x, uint8_t y);
 
 testable void initializeFunctionModules(int version, uint8_t qrcode[]);
 static void drawWhiteFunctionModules(uint8_t qrcode[], int version);
+static int getFormatBits(enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask);
 static void drawFormatBits(enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask, uint8_t qrcode[]);
+static void drawPackedFormatBits(int bits, uint32_t rows[][qrcodegen_ROW_WORDS], int qrsize);
 testable int getAlignmentPatternPositions(int version, uint8_t result[7]);
 static void fillRectangle(int left, int top, int width, int height, uint8_t qrcode[]);
 
 static void drawCodewords(const uint8_t data[], int dataLen, uint8_t qrcode[]);
+#if qrcodegen_LAYOUT_CACHE_VERSION_MAX > 0
+static void buildLayout(int version);
+#endif
+static bool drawLayout(int version, const uint8_t data[], uint8_t qrcode[], uint8_t functionModules[]);
 static void applyMask(const uint8_t functionModules[], uint8_t qrcode[], enum qrcodegen_Mask mask);
-static long getPenaltyScore(const uint8_t qrcode[]);
+static uint32_t getMaskWord(const uint8_t functionModules[], int x, int y, enum qrcodegen_Mask mask);
+static enum qrcodegen_Mask chooseMask(const uint8_t functionModules[], const uint8_t qrcode[], enum qrcodegen_Ecc ecl);
+static long getPenaltyScore(const uint8_t functionModules[], const uint8_t qrcode[],
+	enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask, struct PenaltyGrids *grids);
+static long getLinePenalty(const uint32_t line[], int qrsize);
 static int finderPenaltyCountPatterns(const int runHistory[7], int qrsize);
 static int finderPenaltyTerminateAndCount(bool currentRunColor, int currentRunLength, int runHistory[7], int qrsize);
 static void finderPenaltyAddHistory(int currentRunLength, int runHistory[7]);
@@ -81,6 +116,12 @@ testable void setModule(uint8_t qrcode[], int x, int y, bool isBlack);
 testable void setModuleBounded(uint8_t qrcode[], int x, int y, bool isBlack);
 static bool getBit(int x, int i);
 
+static uint32_t getRowWord(const uint8_t grid[], int x, int y);
+static void xorRowWord(uint8_t grid[], int x, int y, uint32_t bits);
+static void transposeGrid(const uint32_t rows[][qrcodegen_ROW_WORDS], uint32_t columns[][qrcodegen_ROW_WORDS], int qrsize);
+static int countOnes(uint32_t x);
+static int countTrailingZeros(uint32_t x);
+
 testable int calcSegmentBitLength(enum qrcodegen_Mode mode, size_t numChars);
 testable int getTotalBits(const struct qrcodegen_Segment segs[], size_t len, int version);
 static int numCharCountBits(enum qrcodegen_Mode mode, int version);
@@ -121,6 +162,124 @@ static const int PENALTY_N2 =  3;
 static const int PENALTY_N3 = 40;
 static const int PENALTY_N4 = 10;
 
+// The mask patterns by rows, module x at bit x % 32 of word (x / 32) % 3 of row y % 12.
+// All the patterns repeat every 6 modules along x and every 12 along y, 96 modules fit
+// 3 words exactly, so a whole word of any row is a single lookup. Bit set = invert the module.
+static const uint32_t MASK_PATTERNS[8][12][3] = {
+	{  // Mask 0
+		{0x55555555U, 0x55555555U, 0x55555555U},
+		{0xAAAAAAAAU, 0xAAAAAAAAU, 0xAAAAAAAAU},
+		{0x55555555U, 0x55555555U, 0x55555555U},
+		{0xAAAAAAAAU, 0xAAAAAAAAU, 0xAAAAAAAAU},
+		{0x55555555U, 0x55555555U, 0x55555555U},
+		{0xAAAAAAAAU, 0xAAAAAAAAU, 0xAAAAAAAAU},
+		{0x55555555U, 0x55555555U, 0x55555555U},
+		{0xAAAAAAAAU, 0xAAAAAAAAU, 0xAAAAAAAAU},
+		{0x55555555U, 0x55555555U, 0x55555555U},
+		{0xAAAAAAAAU, 0xAAAAAAAAU, 0xAAAAAAAAU},
+		{0x55555555U, 0x55555555U, 0x55555555U},
+		{0xAAAAAAAAU, 0xAAAAAAAAU, 0xAAAAAAAAU},
+	},
+	{  // Mask 1
+		{0xFFFFFFFFU, 0xFFFFFFFFU, 0xFFFFFFFFU},
+		{0x00000000U, 0x00000000U, 0x00000000U},
+		{0xFFFFFFFFU, 0xFFFFFFFFU, 0xFFFFFFFFU},
+		{0x00000000U, 0x00000000U, 0x00000000U},
+		{0xFFFFFFFFU, 0xFFFFFFFFU, 0xFFFFFFFFU},
+		{0x00000000U, 0x00000000U, 0x00000000U},
+		{0xFFFFFFFFU, 0xFFFFFFFFU, 0xFFFFFFFFU},
+		{0x00000000U, 0x00000000U, 0x00000000U},
+		{0xFFFFFFFFU, 0xFFFFFFFFU, 0xFFFFFFFFU},
+		{0x00000000U, 0x00000000U, 0x00000000U},
+		{0xFFFFFFFFU, 0xFFFFFFFFU, 0xFFFFFFFFU},
+		{0x00000000U, 0x00000000U, 0x00000000U},
+	},
+	{  // Mask 2
+		{0x49249249U, 0x92492492U, 0x24924924U},
+		{0x49249249U, 0x92492492U, 0x24924924U},
+		{0x49249249U, 0x92492492U, 0x24924924U},
+		{0x49249249U, 0x92492492U, 0x24924924U},
+		{0x49249249U, 0x92492492U, 0x24924924U},
+		{0x49249249U, 0x92492492U, 0x24924924U},
+		{0x49249249U, 0x92492492U, 0x24924924U},
+		{0x49249249U, 0x92492492U, 0x24924924U},
+		{0x49249249U, 0x92492492U, 0x24924924U},
+		{0x49249249U, 0x92492492U, 0x24924924U},
+		{0x49249249U, 0x92492492U, 0x24924924U},
+		{0x49249249U, 0x92492492U, 0x24924924U},
+	},
+	{  // Mask 3
+		{0x49249249U, 0x92492492U, 0x24924924U},
+		{0x24924924U, 0x49249249U, 0x92492492U},
+		{0x92492492U, 0x24924924U, 0x49249249U},
+		{0x49249249U, 0x92492492U, 0x24924924U},
+		{0x24924924U, 0x49249249U, 0x92492492U},
+		{0x92492492U, 0x24924924U, 0x49249249U},
+		{0x49249249U, 0x92492492U, 0x24924924U},
+		{0x24924924U, 0x49249249U, 0x92492492U},
+		{0x92492492U, 0x24924924U, 0x49249249U},
+		{0x49249249U, 0x92492492U, 0x24924924U},
+		{0x24924924U, 0x49249249U, 0x92492492U},
+		{0x92492492U, 0x24924924U, 0x49249249U},
+	},
+	{  // Mask 4
+		{0xC71C71C7U, 0x71C71C71U, 0x1C71C71CU},
+		{0xC71C71C7U, 0x71C71C71U, 0x1C71C71CU},
+		{0x38E38E38U, 0x8E38E38EU, 0xE38E38E3U},
+		{0x38E38E38U, 0x8E38E38EU, 0xE38E38E3U},
+		{0xC71C71C7U, 0x71C71C71U, 0x1C71C71CU},
+		{0xC71C71C7U, 0x71C71C71U, 0x1C71C71CU},
+		{0x38E38E38U, 0x8E38E38EU, 0xE38E38E3U},
+		{0x38E38E38U, 0x8E38E38EU, 0xE38E38E3U},
+		{0xC71C71C7U, 0x71C71C71U, 0x1C71C71CU},
+		{0xC71C71C7U, 0x71C71C71U, 0x1C71C71CU},
+		{0x38E38E38U, 0x8E38E38EU, 0xE38E38E3U},
+		{0x38E38E38U, 0x8E38E38EU, 0xE38E38E3U},
+	},
+	{  // Mask 5
+		{0xFFFFFFFFU, 0xFFFFFFFFU, 0xFFFFFFFFU},
+		{0x41041041U, 0x10410410U, 0x04104104U},
+		{0x49249249U, 0x92492492U, 0x24924924U},
+		{0x55555555U, 0x55555555U, 0x55555555U},
+		{0x49249249U, 0x92492492U, 0x24924924U},
+		{0x41041041U, 0x10410410U, 0x04104104U},
+		{0xFFFFFFFFU, 0xFFFFFFFFU, 0xFFFFFFFFU},
+		{0x41041041U, 0x10410410U, 0x04104104U},
+		{0x49249249U, 0x92492492U, 0x24924924U},
+		{0x55555555U, 0x55555555U, 0x55555555U},
+		{0x49249249U, 0x92492492U, 0x24924924U},
+		{0x41041041U, 0x10410410U, 0x04104104U},
+	},
+	{  // Mask 6
+		{0xFFFFFFFFU, 0xFFFFFFFFU, 0xFFFFFFFFU},
+		{0xC71C71C7U, 0x71C71C71U, 0x1C71C71CU},
+		{0xDB6DB6DBU, 0xB6DB6DB6U, 0x6DB6DB6DU},
+		{0x55555555U, 0x55555555U, 0x55555555U},
+		{0x6DB6DB6DU, 0xDB6DB6DBU, 0xB6DB6DB6U},
+		{0x71C71C71U, 0x1C71C71CU, 0xC71C71C7U},
+		{0xFFFFFFFFU, 0xFFFFFFFFU, 0xFFFFFFFFU},
+		{0xC71C71C7U, 0x71C71C71U, 0x1C71C71CU},
+		{0xDB6DB6DBU, 0xB6DB6DB6U, 0x6DB6DB6DU},
+		{0x55555555U, 0x55555555U, 0x55555555U},
+		{0x6DB6DB6DU, 0xDB6DB6DBU, 0xB6DB6DB6U},
+		{0x71C71C71U, 0x1C71C71CU, 0xC71C71C7U},
+	},
+	{  // Mask 7
+		{0x55555555U, 0x55555555U, 0x55555555U},
+		{0x38E38E38U, 0x8E38E38EU, 0xE38E38E3U},
+		{0x71C71C71U, 0x1C71C71CU, 0xC71C71C7U},
+		{0xAAAAAAAAU, 0xAAAAAAAAU, 0xAAAAAAAAU},
+		{0xC71C71C7U, 0x71C71C71U, 0x1C71C71CU},
+		{0x8E38E38EU, 0xE38E38E3U, 0x38E38E38U},
+		{0x55555555U, 0x55555555U, 0x55555555U},
+		{0x38E38E38U, 0x8E38E38EU, 0xE38E38E3U},
+		{0x71C71C71U, 0x1C71C71CU, 0xC71C71C7U},
+		{0xAAAAAAAAU, 0xAAAAAAAAU, 0xAAAAAAAAU},
+		{0xC71C71C7U, 0x71C71C71U, 0x1C71C71CU},
+		{0x8E38E38EU, 0xE38E38E3U, 0x38E38E38U},
+	},
+};
+
 
 
 /*---- High-level QR Code encoding functions ----*/
@@ -257,26 +416,16 @@ bool qrcodegen_encodeSegmentsAdvanced(const struct qrcodegen_Segment segs[], siz
 	
 	// Draw function and data codeword modules
 	addEccAndInterleave(qrcode, version, ecl, tempBuffer);
-	initializeFunctionModules(version, qrcode);
-	drawCodewords(tempBuffer, getNumRawDataModules(version) / 8, qrcode);
-	drawWhiteFunctionModules(qrcode, version);
-	initializeFunctionModules(version, tempBuffer);
+	if (!drawLayout(version, tempBuffer, qrcode, tempBuffer)) {  // Not cached, draw the geometric way
+		initializeFunctionModules(version, qrcode);
+		drawCodewords(tempBuffer, getNumRawDataModules(version) / 8, qrcode);
+		drawWhiteFunctionModules(qrcode, version);
+		initializeFunctionModules(version, tempBuffer);
+	}
 	
 	// Handle masking
-	if (mask == qrcodegen_Mask_AUTO) {  // Automatically choose best mask
-		long minPenalty = LONG_MAX;
-		for (int i = 0; i < 8; i++) {
-			enum qrcodegen_Mask msk = (enum qrcodegen_Mask)i;
-			applyMask(tempBuffer, qrcode, msk);
-			drawFormatBits(ecl, msk, qrcode);
-			long penalty = getPenaltyScore(qrcode);
-			if (penalty < minPenalty) {
-				mask = msk;
-				minPenalty = penalty;
-			}
-			applyMask(tempBuffer, qrcode, msk);  // Undoes the mask due to XOR
-		}
-	}
+	if (mask == qrcodegen_Mask_AUTO)  // Automatically choose best mask
+		mask = chooseMask(tempBuffer, qrcode, ecl);
 	assert(0 <= (int)mask && (int)mask <= 7);
 	applyMask(tempBuffer, qrcode, mask);
 	drawFormatBits(ecl, mask, qrcode);
@@ -303,8 +452,7 @@ testable void addEccAndInterleave(uint8_t data[], int version, enum qrcodegen_Ec
 	
 	// Split data into blocks, calculate ECC, and interleave
 	// (not concatenate) the bytes into a single sequence
-	uint8_t rsdiv[qrcodegen_REED_SOLOMON_DEGREE_MAX];
-	reedSolomonComputeDivisor(blockEccLen, rsdiv);
+	const uint8_t *rsdiv = reedSolomonGetDivisor(blockEccLen);
 	const uint8_t *dat = data;
 	for (int i = 0; i < numBlocks; i++) {
 		int datLen = shortBlockDataLen + (i < numShortBlocks ? 0 : 1);
@@ -352,63 +500,142 @@ testable int getNumRawDataModules(int ver) {
 
 /*---- Reed-Solomon ECC generator functions ----*/
 
-// Computes a Reed-Solomon ECC generator polynomial for the given degree, storing in result[0 : degree].
-// This could be implemented as a lookup table over all possible parameter values, instead of as an algorithm.
-testable void reedSolomonComputeDivisor(int degree, uint8_t result[]) {
+// Exponentials of the generator element 0x02 in GF(2^8/0x11D): GF_EXP[i] = 0x02^i.
+// The 255 values repeat once more so that GF_EXP[GF_LOG[x] + GF_LOG[y]] needs no modulo.
+static const uint8_t GF_EXP[512] = {
+	  1,   2,   4,   8,  16,  32,  64, 128,  29,  58, 116, 232, 205, 135,  19,  38,
+	 76, 152,  45,  90, 180, 117, 234, 201, 143,   3,   6,  12,  24,  48,  96, 192,
+	157,  39,  78, 156,  37,  74, 148,  53, 106, 212, 181, 119, 238, 193, 159,  35,
+	 70, 140,   5,  10,  20,  40,  80, 160,  93, 186, 105, 210, 185, 111, 222, 161,
+	 95, 190,  97, 194, 153,  47,  94, 188, 101, 202, 137,  15,  30,  60, 120, 240,
+	253, 231, 211, 187, 107, 214, 177, 127, 254, 225, 223, 163,  91, 182, 113, 226,
+	217, 175,  67, 134,  17,  34,  68, 136,  13,  26,  52, 104, 208, 189, 103, 206,
+	129,  31,  62, 124, 248, 237, 199, 147,  59, 118, 236, 197, 151,  51, 102, 204,
+	133,  23,  46,  92, 184, 109, 218, 169,  79, 158,  33,  66, 132,  21,  42,  84,
+	168,  77, 154,  41,  82, 164,  85, 170,  73, 146,  57, 114, 228, 213, 183, 115,
+	230, 209, 191,  99, 198, 145,  63, 126, 252, 229, 215, 179, 123, 246, 241, 255,
+	227, 219, 171,  75, 150,  49,  98, 196, 149,  55, 110, 220, 165,  87, 174,  65,
+	130,  25,  50, 100, 200, 141,   7,  14,  28,  56, 112, 224, 221, 167,  83, 166,
+	 81, 162,  89, 178, 121, 242, 249, 239, 195, 155,  43,  86, 172,  69, 138,   9,
+	 18,  36,  72, 144,  61, 122, 244, 245, 247, 243, 251, 235, 203, 139,  11,  22,
+	 44,  88, 176, 125, 250, 233, 207, 131,  27,  54, 108, 216, 173,  71, 142,   1,
+	  2,   4,   8,  16,  32,  64, 128,  29,  58, 116, 232, 205, 135,  19,  38,  76,
+	152,  45,  90, 180, 117, 234, 201, 143,   3,   6,  12,  24,  48,  96, 192, 157,
+	 39,  78, 156,  37,  74, 148,  53, 106, 212, 181, 119, 238, 193, 159,  35,  70,
+	140,   5,  10,  20,  40,  80, 160,  93, 186, 105, 210, 185, 111, 222, 161,  95,
+	190,  97, 194, 153,  47,  94, 188, 101, 202, 137,  15,  30,  60, 120, 240, 253,
+	231, 211, 187, 107, 214, 177, 127, 254, 225, 223, 163,  91, 182, 113, 226, 217,
+	175,  67, 134,  17,  34,  68, 136,  13,  26,  52, 104, 208, 189, 103, 206, 129,
+	 31,  62, 124, 248, 237, 199, 147,  59, 118, 236, 197, 151,  51, 102, 204, 133,
+	 23,  46,  92, 184, 109, 218, 169,  79, 158,  33,  66, 132,  21,  42,  84, 168,
+	 77, 154,  41,  82, 164,  85, 170,  73, 146,  57, 114, 228, 213, 183, 115, 230,
+	209, 191,  99, 198, 145,  63, 126, 252, 229, 215, 179, 123, 246, 241, 255, 227,
+	219, 171,  75, 150,  49,  98, 196, 149,  55, 110, 220, 165,  87, 174,  65, 130,
+	 25,  50, 100, 200, 141,   7,  14,  28,  56, 112, 224, 221, 167,  83, 166,  81,
+	162,  89, 178, 121, 242, 249, 239, 195, 155,  43,  86, 172,  69, 138,   9,  18,
+	 36,  72, 144,  61, 122, 244, 245, 247, 243, 251, 235, 203, 139,  11,  22,  44,
+	 88, 176, 125, 250, 233, 207, 131,  27,  54, 108, 216, 173,  71, 142,   1,   2,
+};
+
+// Discrete logarithms: GF_EXP[GF_LOG[x]] == x for x in [1, 255]. GF_LOG[0] is unused.
+static const uint8_t GF_LOG[256] = {
+	  0,   0,   1,  25,   2,  50,  26, 198,   3, 223,  51, 238,  27, 104, 199,  75,
+	  4, 100, 224,  14,  52, 141, 239, 129,  28, 193, 105, 248, 200,   8,  76, 113,
+	  5, 138, 101,  47, 225,  36,  15,  33,  53, 147, 142, 218, 240,  18, 130,  69,
+	 29, 181, 194, 125, 106,  39, 249, 185, 201, 154,   9, 120,  77, 228, 114, 166,
+	  6, 191, 139,  98, 102, 221,  48, 253, 226, 152,  37, 179,  16, 145,  34, 136,
+	 54, 208, 148, 206, 143, 150, 219, 189, 241, 210,  19,  92, 131,  56,  70,  64,
+	 30,  66, 182, 163, 195,  72, 126, 110, 107,  58,  40,  84, 250, 133, 186,  61,
+	202,  94, 155, 159,  10,  21, 121,  43,  78, 212, 229, 172, 115, 243, 167,  87,
+	  7, 112, 192, 247, 140, 128,  99,  13, 103,  74, 222, 237,  49, 197, 254,  24,
+	227, 165, 153, 119,  38, 184, 180, 124,  17,  68, 146, 217,  35,  32, 137,  46,
+	 55,  63, 209,  91, 149, 188, 207, 205, 144, 135, 151, 178, 220, 252, 190,  97,
+	242,  86, 211, 171,  20,  42,  93, 158, 132,  60,  57,  83,  71, 109,  65, 162,
+	 31,  45,  67, 216, 183, 123, 164, 118, 196,  23,  73, 236, 127,  12, 111, 246,
+	108, 161,  59,  82,  41, 157,  85, 170, 251,  96, 134, 177, 187, 204,  62,  90,
+	203,  89,  95, 176, 156, 169, 160,  81,  11, 245,  22, 235, 122, 117,  44, 215,
+	 79, 174, 213, 233, 230, 231, 173, 232, 116, 214, 244, 234, 168,  80,  88, 175,
+};
+
+// Reed-Solomon generator polynomials (x - r^0) * (x - r^1) * ... * (x - r^{degree-1}) for
+// every degree in [1, 30], with r = 0x02. Coefficients are stored from highest to lowest power,
+// excluding the leading term which is always 1, as logarithms: none of them is zero.
+// The polynomial of a given degree starts at offset degree * (degree - 1) / 2.
+static const uint8_t RS_GENERATOR_LOG[qrcodegen_REED_SOLOMON_DEGREE_MAX * (qrcodegen_REED_SOLOMON_DEGREE_MAX + 1) / 2] = {
+	  0,  // 1
+	 25,   1,  // 2
+	198, 199,   3,  // 3
+	 75, 249,  78,   6,  // 4
+	113, 164, 166, 119,  10,  // 5
+	166,   0, 134,   5, 176,  15,  // 6
+	 87, 229, 146, 149, 238, 102,  21,  // 7
+	175, 238, 208, 249, 215, 252, 196,  28,  // 8
+	 95, 246, 137, 231, 235, 149,  11, 123,  36,  // 9
+	251,  67,  46,  61, 118,  70,  64,  94,  32,  45,  // 10
+	220, 192,  91, 194, 172, 177, 209, 116, 227,  10,  55,  // 11
+	102,  43,  98, 121, 187, 113, 198, 143, 131,  87, 157,  66,  // 12
+	 74, 152, 176, 100,  86, 100, 106, 104, 130, 218, 206, 140,  78,  // 13
+	199, 249, 155,  48, 190, 124, 218, 137, 216,  87, 207,  59,  22,  91,  // 14
+	  8, 183,  61,  91, 202,  37,  51,  58,  58, 237, 140, 124,   5,  99, 105,  // 15
+	120, 104, 107, 109, 102, 161,  76,   3,  91, 191, 147, 169, 182, 194, 225, 120,  // 16
+	 43, 139, 206,  78,  43, 239, 123, 206, 214, 147,  24,  99, 150,  39, 243, 163, 136,  // 17
+	215, 234, 158,  94, 184,  97, 118, 170,  79, 187, 152, 148, 252, 179,   5,  98,  96, 153,  // 18
+	 67,   3, 105, 153,  52,  90,  83,  17, 150, 159,  44, 128, 153, 133, 252, 222, 138, 220, 171,  // 19
+	 17,  60,  79,  50,  61, 163,  26, 187, 202, 180, 221, 225,  83, 239, 156, 164, 212, 212, 188, 190,  // 20
+	240, 233, 104, 247, 181, 140,  67,  98,  85, 200, 210, 115, 148, 137, 230,  36, 122, 254, 148, 175, 210,  // 21
+	210, 171, 247, 242,  93, 230,  14, 109, 221,  53, 200,  74,   8, 172,  98,  80, 219, 134, 160, 105, 165, 231,  // 22
+	171, 102, 146,  91,  49, 103,  65,  17, 193, 150,  14,  25, 183, 248,  94, 164, 224, 192,   1,  78,  56, 147, 253,  // 23
+	229, 121, 135,  48, 211, 117, 251, 126, 159, 180, 169, 152, 192, 226, 228, 218, 111,   0, 117, 232,  87,  96, 227,  21,  // 24
+	231, 181, 156,  39, 170,  26,  12,  59,  15, 148, 201,  54,  66, 237, 208,  99, 167, 144, 182,  95, 243, 129, 178, 252,  45,  // 25
+	173, 125, 158,   2, 103, 182, 118,  17, 145, 201, 111,  28, 165,  53, 161,  21, 245, 142,  13, 102,  48, 227, 153, 145, 218,  70,  // 26
+	 79, 228,   8, 165, 227,  21, 180,  29,   9, 237,  70,  99,  45,  58, 138, 135,  73, 126, 172,  94, 216, 193, 157,  26,  17, 149,  96,  // 27
+	168, 223, 200, 104, 224, 234, 108, 180, 110, 190, 195, 147, 205,  27, 232, 201,  21,  43, 245,  87,  42, 195, 212, 119, 242,  37,   9, 123,  // 28
+	156,  45, 183,  29, 151, 219,  54,  96, 249,  24, 136,   5, 241, 175, 189,  28,  75, 234, 150, 148,  23,   9, 202, 162,  68, 250, 140,  24, 151,  // 29
+	 41, 173, 145, 152, 216,  31, 179, 182,  50,  48, 110,  86, 239,  96, 222, 125,  42, 173, 226, 193, 224, 130, 156,  37, 251, 216, 238,  40, 192, 180,  // 30
+};
+
+
+// Returns the Reed-Solomon ECC generator polynomial for the given degree, as degree logarithms
+// of its coefficients. The polynomials are precomputed, the result points into a constant table.
+testable const uint8_t *reedSolomonGetDivisor(int degree) {
 	assert(1 <= degree && degree <= qrcodegen_REED_SOLOMON_DEGREE_MAX);
-	// Polynomial coefficients are stored from highest to lowest power, excluding the leading term which is always 1.
-	// For example the polynomial x^3 + 255x^2 + 8x + 93 is stored as the uint8 array {255, 8, 93}.
-	memset(result, 0, (size_t)degree * sizeof(result[0]));
-	result[degree - 1] = 1;  // Start off with the monomial x^0
-	
-	// Compute the product polynomial (x - r^0) * (x - r^1) * (x - r^2) * ... * (x - r^{degree-1}),
-	// drop the highest monomial term which is always 1x^degree.
-	// Note that r = 0x02, which is a generator element of this field GF(2^8/0x11D).
-	uint8_t root = 1;
-	for (int i = 0; i < degree; i++) {
-		// Multiply the current product by (x - r^i)
-		for (int j = 0; j < degree; j++) {
-			result[j] = reedSolomonMultiply(result[j], root);
-			if (j + 1 < degree)
-				result[j] ^= result[j + 1];
-		}
-		root = reedSolomonMultiply(root, 0x02);
-	}
+	return &RS_GENERATOR_LOG[degree * (degree - 1) / 2];
 }
 
 
 // Computes the Reed-Solomon error correction codeword for the given data and divisor polynomials.
 // The remainder when data[0 : dataLen] is divided by divisor[0 : degree] is stored in result[0 : degree].
 // All polynomials are in big endian, and the generator has an implicit leading 1 term.
+// The generator coefficients are logarithms, as returned by reedSolomonGetDivisor().
 testable void reedSolomonComputeRemainder(const uint8_t data[], int dataLen,
 		const uint8_t generator[], int degree, uint8_t result[]) {
 	assert(1 <= degree && degree <= qrcodegen_REED_SOLOMON_DEGREE_MAX);
-	memset(result, 0, (size_t)degree * sizeof(result[0]));
+	// The remainder is a circular buffer whose highest coefficient is rem[head],
+	// so dropping it after each step is a single index increment instead of a shift
+	uint8_t rem[qrcodegen_REED_SOLOMON_DEGREE_MAX] = {0};
+	int head = 0;
 	for (int i = 0; i < dataLen; i++) {  // Polynomial division
-		uint8_t factor = data[i] ^ result[0];
-		memmove(&result[0], &result[1], (size_t)(degree - 1) * sizeof(result[0]));
-		result[degree - 1] = 0;
-		for (int j = 0; j < degree; j++)
-			result[j] ^= reedSolomonMultiply(generator[j], factor);
+		uint8_t factor = data[i] ^ rem[head];
+		rem[head] = 0;
+		head = (head + 1 < degree) ? head + 1 : 0;
+		if (factor == 0)
+			continue;
+		// Multiply-accumulate: rem[(head + j) % degree] ^= generator[j] * factor,
+		// split in two loops where the circular buffer wraps around
+		const uint8_t *product = &GF_EXP[GF_LOG[factor]];
+		int wrap = degree - head;
+		for (int j = 0; j < wrap; j++)
+			rem[head + j] ^= product[generator[j]];
+		for (int j = wrap; j < degree; j++)
+			rem[j - wrap] ^= product[generator[j]];
 	}
+	for (int j = 0; j < degree; j++)
+		result[j] = rem[(head + j) % degree];
 }
 
 #undef qrcodegen_REED_SOLOMON_DEGREE_MAX
 
 
-// Returns the product of the two given field elements modulo GF(2^8/0x11D).
-// All inputs are valid. This could be implemented as a 256*256 lookup table.
-testable uint8_t reedSolomonMultiply(uint8_t x, uint8_t y) {
-	// Russian peasant multiplication
-	uint8_t z = 0;
-	for (int i = 7; i >= 0; i--) {
-		z = (uint8_t)((z << 1) ^ ((z >> 7) * 0x11D));
-		z ^= ((y >> i) & 1) * x;
-	}
-	return z;
-}
-
-
 
 /*---- Drawing function modules ----*/
 
@@ -509,10 +736,8 @@ static void drawWhiteFunctionModules(uint8_t qrcode[], int version) {
 }
 
 
-// Draws two copies of the format bits (with its own error correction code) based
-// on the given mask and error correction level. This always draws all modules of
-// the format bits, unlike drawWhiteFunctionModules() which might skip black modules.
-static void drawFormatBits(enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask, uint8_t qrcode[]) {
+// Returns the 15 format bits, with their own error correction code, for the given mask and error correction level.
+static int getFormatBits(enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask) {
 	// Calculate error correction code and pack bits
 	assert(0 <= (int)mask && (int)mask <= 7);
 	static const int table[] = {1, 0, 3, 2};
@@ -522,6 +747,15 @@ static void drawFormatBits(enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask, uin
 		rem = (rem << 1) ^ ((rem >> 9) * 0x537);
 	int bits = (data << 10 | rem) ^ 0x5412;  // uint15
 	assert(bits >> 15 == 0);
+	return bits;
+}
+
+
+// Draws two copies of the format bits (with its own error correction code) based
+// on the given mask and error correction level. This always draws all modules of
+// the format bits, unlike drawWhiteFunctionModules() which might skip black modules.
+static void drawFormatBits(enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask, uint8_t qrcode[]) {
+	int bits = getFormatBits(ecl, mask);
 	
 	// Draw first copy
 	for (int i = 0; i <= 5; i++)
@@ -542,6 +776,30 @@ static void drawFormatBits(enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask, uin
 }
 
 
+// Draws the given format bits like drawFormatBits(), on a grid packed by rows as getPenaltyScore() uses.
+static void drawPackedFormatBits(int bits, uint32_t rows[][qrcodegen_ROW_WORDS], int qrsize) {
+	// Row 8 holds the format bits [0, 8] at x = 7 and x <= 5, and [0, 7] at the right edge
+	uint32_t *row = rows[8];
+	row[0] &= ~(uint32_t)0x1BF;
+	row[0] |= (uint32_t)getBit(bits, 8) << 7;
+	for (int i = 9; i < 15; i++)
+		row[0] |= (uint32_t)getBit(bits, i) << (14 - i);
+	for (int i = 0; i < 8; i++) {
+		int x = qrsize - 1 - i;
+		row[x >> 5] = (row[x >> 5] & ~((uint32_t)1 << (x & 31))) | (uint32_t)getBit(bits, i) << (x & 31);
+	}
+	
+	// Column 8 holds the rest, module 8 is bit 8 of the first word of every row
+	for (int i = 0; i <= 5; i++)
+		rows[i][0] = (rows[i][0] & ~(uint32_t)0x100) | (uint32_t)getBit(bits, i) << 8;
+	rows[7][0] = (rows[7][0] & ~(uint32_t)0x100) | (uint32_t)getBit(bits, 6) << 8;
+	rows[8][0] = (rows[8][0] & ~(uint32_t)0x100) | (uint32_t)getBit(bits, 7) << 8;
+	for (int i = 8; i < 15; i++)
+		rows[qrsize - 15 + i][0] = (rows[qrsize - 15 + i][0] & ~(uint32_t)0x100) | (uint32_t)getBit(bits, i) << 8;
+	rows[qrsize - 8][0] |= 0x100;  // Always black
+}
+
+
 // Calculates and stores an ascending list of positions of alignment patterns
 // for this version number, returning the length of the list (in the range [0,7]).
 // Each position is in the range [0,177), and are used on both the x and y axes.
@@ -599,6 +857,7 @@ static void drawCodewords(const uint8_t data[], int dataLen, uint8_t qrcode[]) {
 }
 
 
+
 // XORs the codeword modules in this QR Code with the given mask pattern.
 // The function modules must be marked and the codeword bits must be drawn
 // before masking. Due to the arithmetic of XOR, calling applyMask() with
@@ -608,102 +867,72 @@ static void applyMask(const uint8_t functionModules[], uint8_t qrcode[], enum qr
 	assert(0 <= (int)mask && (int)mask <= 7);  // Disallows qrcodegen_Mask_AUTO
 	int qrsize = qrcodegen_getSize(qrcode);
 	for (int y = 0; y < qrsize; y++) {
-		for (int x = 0; x < qrsize; x++) {
-			if (getModule(functionModules, x, y))
-				continue;
-			bool invert;
-			switch ((int)mask) {
-				case 0:  invert = (x + y) % 2 == 0;                    break;
-				case 1:  invert = y % 2 == 0;                          break;
-				case 2:  invert = x % 3 == 0;                          break;
-				case 3:  invert = (x + y) % 3 == 0;                    break;
-				case 4:  invert = (x / 3 + y / 2) % 2 == 0;            break;
-				case 5:  invert = x * y % 2 + x * y % 3 == 0;          break;
-				case 6:  invert = (x * y % 2 + x * y % 3) % 2 == 0;    break;
-				case 7:  invert = ((x + y) % 2 + x * y % 3) % 2 == 0;  break;
-				default:  assert(false);  return;
-			}
-			bool val = getModule(qrcode, x, y);
-			setModule(qrcode, x, y, val ^ invert);
-		}
+		for (int x = 0; x < qrsize; x += 32)
+			xorRowWord(qrcode, x, y, getMaskWord(functionModules, x, y, mask));
 	}
 }
 
 
-// Calculates and returns the penalty score based on state of the given QR Code's current modules.
-// This is used by the automatic mask choice algorithm to find the mask pattern that yields the lowest score.
-static long getPenaltyScore(const uint8_t qrcode[]) {
+// Returns the modules [x, x + 32) of row y that the given mask inverts, as the bits of a word:
+// the mask pattern, except at function modules and past the end of the row.
+static uint32_t getMaskWord(const uint8_t functionModules[], int x, int y, enum qrcodegen_Mask mask) {
+	int qrsize = functionModules[0];
+	uint32_t row = (qrsize - x < 32) ? ((uint32_t)1 << (qrsize - x)) - 1 : UINT32_MAX;
+	return MASK_PATTERNS[(int)mask][y % 12][(x / 32) % 3] & ~getRowWord(functionModules, x, y) & row;
+}
+
+
+// Returns the penalty score that the given QR Code would have with the given mask and its format bits
+// applied. The QR Code must be unmasked, the function modules are marked in functionModules. The
+// modules are scored a whole word at a time, on a copy packed by rows and another one packed by columns,
+// both in the given scratch grids. This is used by the automatic mask choice algorithm to find the mask
+// pattern that yields the lowest score.
+static long getPenaltyScore(const uint8_t functionModules[], const uint8_t qrcode[],
+		enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask, struct PenaltyGrids *grids) {
 	int qrsize = qrcodegen_getSize(qrcode);
-	long result = 0;
+	int words = (qrsize + 31) / 32;
+	uint32_t (*rows)[qrcodegen_ROW_WORDS] = grids->rows;
+	uint32_t (*columns)[qrcodegen_ROW_WORDS] = grids->columns;
 	
-	// Adjacent modules in row having same color, and finder-like patterns
+	// Apply the mask to a packed copy of the modules, then draw the format bits
 	for (int y = 0; y < qrsize; y++) {
-		bool runColor = false;
-		int runX = 0;
-		int runHistory[7] = {0};
-		int padRun = qrsize;  // Add white border to initial run
-		for (int x = 0; x < qrsize; x++) {
-			if (getModule(qrcode, x, y) == runColor) {
-				runX++;
-				if (runX == 5)
-					result += PENALTY_N1;
-				else if (runX > 5)
-					result++;
-			} else {
-				finderPenaltyAddHistory(runX + padRun, runHistory);
-				padRun = 0;
-				if (!runColor)
-					result += finderPenaltyCountPatterns(runHistory, qrsize) * PENALTY_N3;
-				runColor = getModule(qrcode, x, y);
-				runX = 1;
-			}
-		}
-		result += finderPenaltyTerminateAndCount(runColor, runX + padRun, runHistory, qrsize) * PENALTY_N3;
-	}
-	// Adjacent modules in column having same color, and finder-like patterns
-	for (int x = 0; x < qrsize; x++) {
-		bool runColor = false;
-		int runY = 0;
-		int runHistory[7] = {0};
-		int padRun = qrsize;  // Add white border to initial run
-		for (int y = 0; y < qrsize; y++) {
-			if (getModule(qrcode, x, y) == runColor) {
-				runY++;
-				if (runY == 5)
-					result += PENALTY_N1;
-				else if (runY > 5)
-					result++;
-			} else {
-				finderPenaltyAddHistory(runY + padRun, runHistory);
-				padRun = 0;
-				if (!runColor)
-					result += finderPenaltyCountPatterns(runHistory, qrsize) * PENALTY_N3;
-				runColor = getModule(qrcode, x, y);
-				runY = 1;
-			}
-		}
-		result += finderPenaltyTerminateAndCount(runColor, runY + padRun, runHistory, qrsize) * PENALTY_N3;
-	}
-	
-	// 2*2 blocks of modules having same color
-	for (int y = 0; y < qrsize - 1; y++) {
-		for (int x = 0; x < qrsize - 1; x++) {
-			bool  color = getModule(qrcode, x, y);
-			if (  color == getModule(qrcode, x + 1, y) &&
-			      color == getModule(qrcode, x, y + 1) &&
-			      color == getModule(qrcode, x + 1, y + 1))
-				result += PENALTY_N2;
-		}
+		for (int x = 0; x < qrsize; x += 32)
+			rows[y][x / 32] = getRowWord(qrcode, x, y) ^ getMaskWord(functionModules, x, y, mask);
 	}
+	drawPackedFormatBits(getFormatBits(ecl, mask), rows, qrsize);
+	transposeGrid(rows, columns, qrsize);
 	
-	// Balance of black and white modules
+	long result = 0;
 	int black = 0;
+	uint32_t lastMask = (qrsize % 32 == 0) ? UINT32_MAX : ((uint32_t)1 << (qrsize % 32)) - 1;
 	for (int y = 0; y < qrsize; y++) {
-		for (int x = 0; x < qrsize; x++) {
-			if (getModule(qrcode, x, y))
-				black++;
+		// Adjacent modules in row and column having same color, and finder-like patterns
+		result += getLinePenalty(rows[y], qrsize);
+		result += getLinePenalty(columns[y], qrsize);
+		
+		// Balance of black and white modules
+		for (int w = 0; w < words; w++)
+			black += countOnes(rows[y][w]);
+		
+		// 2*2 blocks of modules having same color: bit x of same is set when module x is equal
+		// to the one below it, bit x of blocks when modules x and x + 1 are equal in both rows
+		if (y == qrsize - 1)
+			continue;
+		for (int w = 0; w < words; w++) {
+			uint32_t same = ~(rows[y][w] ^ rows[y + 1][w]);
+			uint32_t sameNext = same >> 1;
+			uint32_t next = rows[y][w] >> 1;
+			if (w + 1 < words) {
+				sameNext |= ~(rows[y][w + 1] ^ rows[y + 1][w + 1]) << 31;
+				next |= rows[y][w + 1] << 31;
+			}
+			uint32_t blocks = same & sameNext & ~(rows[y][w] ^ next);
+			if (w == words - 1)
+				blocks &= lastMask >> 1;  // The last module of the row has no right neighbor
+			result += countOnes(blocks) * PENALTY_N2;
 		}
 	}
+	
 	int total = qrsize * qrsize;  // Note that size is odd, so black/total != 1/2
 	// Compute the smallest integer k >= 0 such that (45-5k)% <= black/total <= (55+5k)%
 	int k = (int)((labs(black * 20L - total * 10L) + total - 1) / total) - 1;
@@ -712,6 +941,113 @@ static long getPenaltyScore(const uint8_t qrcode[]) {
 }
 
 
+// Returns the run length and finder-like pattern penalties of a row or a column of qrsize modules,
+// packed in words. Runs are found by scanning for the next module of the other color a word at a time.
+static long getLinePenalty(const uint32_t line[], int qrsize) {
+	long result = 0;
+	bool runColor = false;
+	int runLength = qrsize;  // Add white border to initial run
+	int runHistory[7] = {0};
+	for (int start = 0; start < qrsize; ) {
+		bool color = ((line[start >> 5] >> (start & 31)) & 1) != 0;
+		
+		// Find the end of the run, modules past the end of the line are white
+		uint32_t invert = color ? UINT32_MAX : 0;
+		int w = start >> 5;
+		uint32_t other = (line[w] ^ invert) & (UINT32_MAX << (start & 31));
+		int end = qrsize;
+		while (other == 0 && (w + 1) * 32 < qrsize)
+			other = line[++w] ^ invert;
+		if (other != 0 && w * 32 + countTrailingZeros(other) < qrsize)
+			end = w * 32 + countTrailingZeros(other);
+		
+		int length = end - start;
+		if (length >= 5)
+			result += PENALTY_N1 + length - 5;
+		if (color == runColor)  // Only happens to the initial white run
+			runLength += length;
+		else {
+			finderPenaltyAddHistory(runLength, runHistory);
+			if (!runColor)
+				result += finderPenaltyCountPatterns(runHistory, qrsize) * PENALTY_N3;
+			runColor = color;
+			runLength = length;
+		}
+		start = end;
+	}
+	result += finderPenaltyTerminateAndCount(runColor, runLength, runHistory, qrsize) * PENALTY_N3;
+	return result;
+}
+
+
+#ifdef QRCODEGEN_HOST_THREADS
+
+// Scores one mask on its own thread, see chooseMask().
+struct MaskScoreJob {
+	const uint8_t *functionModules;
+	const uint8_t *qrcode;
+	enum qrcodegen_Ecc ecl;
+	enum qrcodegen_Mask mask;
+	long penalty;
+	bool started;
+	pthread_t thread;
+	struct PenaltyGrids grids;
+};
+
+static struct MaskScoreJob maskScoreJobs[8];
+static pthread_mutex_t maskScoreJobsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void *scoreMaskJob(void *arg) {
+	struct MaskScoreJob *job = (struct MaskScoreJob *)arg;
+	job->penalty = getPenaltyScore(job->functionModules, job->qrcode, job->ecl, job->mask, &job->grids);
+	return NULL;
+}
+
+#else
+
+static struct PenaltyGrids penaltyGrids;
+
+#endif
+
+
+// Returns the mask with the lowest penalty score for the given unmasked QR Code, the first one on a tie.
+// The scratch grids of the scoring are static, off the stack. When QRCODEGEN_HOST_THREADS is defined
+// the eight masks are scored in parallel threads, each with its own grids, which only read the two
+// buffers; concurrent calls take turns. Masks whose thread could not be started are scored on the
+// calling thread.
+static enum qrcodegen_Mask chooseMask(const uint8_t functionModules[], const uint8_t qrcode[], enum qrcodegen_Ecc ecl) {
+	long penalties[8];
+#ifdef QRCODEGEN_HOST_THREADS
+	struct MaskScoreJob *jobs = maskScoreJobs;
+	pthread_mutex_lock(&maskScoreJobsMutex);
+	for (int i = 0; i < 8; i++) {
+		jobs[i].functionModules = functionModules;
+		jobs[i].qrcode = qrcode;
+		jobs[i].ecl = ecl;
+		jobs[i].mask = (enum qrcodegen_Mask)i;
+		jobs[i].started = pthread_create(&jobs[i].thread, NULL, scoreMaskJob, &jobs[i]) == 0;
+	}
+	for (int i = 0; i < 8; i++) {
+		if (jobs[i].started)
+			pthread_join(jobs[i].thread, NULL);
+		else
+			scoreMaskJob(&jobs[i]);
+		penalties[i] = jobs[i].penalty;
+	}
+	pthread_mutex_unlock(&maskScoreJobsMutex);
+#else
+	for (int i = 0; i < 8; i++)
+		penalties[i] = getPenaltyScore(functionModules, qrcode, ecl, (enum qrcodegen_Mask)i, &penaltyGrids);
+#endif
+	enum qrcodegen_Mask result = qrcodegen_Mask_0;
+	for (int i = 1; i < 8; i++) {
+		if (penalties[i] < penalties[(int)result])
+			result = (enum qrcodegen_Mask)i;
+	}
+	return result;
+}
+
+
 // Can only be called immediately after a white run is added, and
 // returns either 0, 1, or 2. A helper function for getPenaltyScore().
 static int finderPenaltyCountPatterns(const int runHistory[7], int qrsize) {
@@ -745,6 +1081,100 @@ static void finderPenaltyAddHistory(int currentRunLength, int runHistory[7]) {
 
 
 
+/*---- Layout cache ----*/
+
+#if qrcodegen_LAYOUT_CACHE_VERSION_MAX > 0
+
+#define qrcodegen_LAYOUT_CACHE_SIZE (qrcodegen_LAYOUT_CACHE_VERSION_MAX * 4 + 17)
+
+// Everything about a QR Code that only depends on its version, for the last version encoded.
+static struct {
+	int version;  // 0 while the cache is empty
+	uint8_t functionModules[qrcodegen_BUFFER_LEN_FOR_VERSION(qrcodegen_LAYOUT_CACHE_VERSION_MAX)];   // As initializeFunctionModules() marks them
+	uint8_t functionPatterns[qrcodegen_BUFFER_LEN_FOR_VERSION(qrcodegen_LAYOUT_CACHE_VERSION_MAX)];  // Drawn, with white codeword modules
+	uint16_t codewordModules[qrcodegen_LAYOUT_CACHE_SIZE * qrcodegen_LAYOUT_CACHE_SIZE];  // Module index y * size + x of each codeword bit
+} layoutCache;
+
+#ifdef QRCODEGEN_HOST_THREADS
+static pthread_mutex_t layoutCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+
+// Fills the layout cache for the given version, which must not be above qrcodegen_LAYOUT_CACHE_VERSION_MAX.
+static void buildLayout(int version) {
+	initializeFunctionModules(version, layoutCache.functionModules);
+	int qrsize = qrcodegen_getSize(layoutCache.functionModules);
+	size_t len = (size_t)((qrsize * qrsize + 7) / 8 + 1) * sizeof(layoutCache.functionModules[0]);
+	memcpy(layoutCache.functionPatterns, layoutCache.functionModules, len);
+	drawWhiteFunctionModules(layoutCache.functionPatterns, version);
+	
+	// The same zigzag scan as drawCodewords(), remembering where every bit goes
+	int i = 0;
+	int numCodewordBits = getNumRawDataModules(version) / 8 * 8;
+	for (int right = qrsize - 1; right >= 1; right -= 2) {
+		if (right == 6)
+			right = 5;
+		for (int vert = 0; vert < qrsize; vert++) {
+			for (int j = 0; j < 2; j++) {
+				int x = right - j;
+				bool upward = ((right + 1) & 2) == 0;
+				int y = upward ? qrsize - 1 - vert : vert;
+				if (!getModule(layoutCache.functionModules, x, y) && i < numCodewordBits) {
+					layoutCache.codewordModules[i] = (uint16_t)(y * qrsize + x);
+					i++;
+				}
+			}
+		}
+	}
+	assert(i == numCodewordBits);
+	layoutCache.version = version;
+}
+
+#endif
+
+
+// Draws the function patterns and the raw codewords (getNumRawDataModules(version) / 8 bytes of data) onto
+// the given QR Code, and marks the function modules in functionModules, which may be the data buffer. Same
+// result as initializeFunctionModules(), drawCodewords(), drawWhiteFunctionModules() and initializeFunctionModules()
+// again, with two copies and a table scatter. The layout is built on first use of a version, and the cache only
+// holds the last one. Returns false without drawing anything if the version is above qrcodegen_LAYOUT_CACHE_VERSION_MAX.
+static bool drawLayout(int version, const uint8_t data[], uint8_t qrcode[], uint8_t functionModules[]) {
+#if qrcodegen_LAYOUT_CACHE_VERSION_MAX > 0
+	if (version > qrcodegen_LAYOUT_CACHE_VERSION_MAX)
+		return false;
+	#ifdef QRCODEGEN_HOST_THREADS
+		pthread_mutex_lock(&layoutCacheMutex);
+	#endif
+	if (layoutCache.version != version)
+		buildLayout(version);
+	
+	int qrsize = version * 4 + 17;
+	size_t len = (size_t)((qrsize * qrsize + 7) / 8 + 1) * sizeof(qrcode[0]);
+	memcpy(qrcode, layoutCache.functionPatterns, len);
+	const uint16_t *modules = layoutCache.codewordModules;
+	int dataLen = getNumRawDataModules(version) / 8;
+	for (int i = 0; i < dataLen; i++, modules += 8) {
+		for (int bits = data[i], j = 0; bits != 0; bits = (bits << 1) & 0xFF, j++) {
+			if ((bits & 0x80) != 0)  // Codeword modules are white in the template, only draw black ones
+				qrcode[(modules[j] >> 3) + 1] |= (uint8_t)(1 << (modules[j] & 7));
+		}
+	}
+	memcpy(functionModules, layoutCache.functionModules, len);
+	#ifdef QRCODEGEN_HOST_THREADS
+		pthread_mutex_unlock(&layoutCacheMutex);
+	#endif
+	return true;
+#else
+	(void)version;
+	(void)data;
+	(void)qrcode;
+	(void)functionModules;
+	return false;
+#endif
+}
+
+
+
 /*---- Basic QR Code information ----*/
 
 // Public function - see documentation comment in header file.
@@ -803,6 +1233,89 @@ static bool getBit(int x, int i) {
 
 
 
+/*---- Word-parallel module access ----*/
+
+// Returns the modules [x, x + 32) of row y as the bits of a word, module x being the lowest bit.
+// Modules past the end of the row read as white. Works on the packed bits of the grid directly.
+static uint32_t getRowWord(const uint8_t grid[], int x, int y) {
+	int qrsize = grid[0];
+	assert(0 <= x && x < qrsize && 0 <= y && y < qrsize);
+	int count = qrsize - x < 32 ? qrsize - x : 32;
+	int index = y * qrsize + x;
+	const uint8_t *bytes = &grid[(index >> 3) + 1];
+	int shift = index & 7;
+	uint64_t result = 0;
+	for (int i = 0; i * 8 < shift + count; i++)  // Only touches bytes that hold modules of the row
+		result |= (uint64_t)bytes[i] << (i * 8);
+	result >>= shift;
+	return (uint32_t)result & (count == 32 ? UINT32_MAX : ((uint32_t)1 << count) - 1);
+}
+
+
+// XORs the bits of the given word into the modules [x, x + 32) of row y, module x being the lowest bit.
+// Bits past the end of the row must be zero.
+static void xorRowWord(uint8_t grid[], int x, int y, uint32_t bits) {
+	int qrsize = grid[0];
+	assert(0 <= x && x < qrsize && 0 <= y && y < qrsize);
+	assert(qrsize - x >= 32 || bits >> (qrsize - x) == 0);
+	int index = y * qrsize + x;
+	uint8_t *bytes = &grid[(index >> 3) + 1];
+	for (uint64_t value = (uint64_t)bits << (index & 7); value != 0; value >>= 8)
+		*bytes++ ^= (uint8_t)value;
+}
+
+
+// Transposes a grid of qrsize * qrsize modules packed by rows, one 32 * 32 block at a time.
+static void transposeGrid(const uint32_t rows[][qrcodegen_ROW_WORDS], uint32_t columns[][qrcodegen_ROW_WORDS], int qrsize) {
+	int words = (qrsize + 31) / 32;
+	for (int bi = 0; bi < words; bi++) {
+		for (int bj = 0; bj < words; bj++) {
+			uint32_t block[32];
+			for (int i = 0; i < 32; i++)
+				block[i] = (bi * 32 + i < qrsize) ? rows[bi * 32 + i][bj] : 0;
+			// Swap the off-diagonal halves of ever smaller sub-blocks
+			uint32_t mask = 0x0000FFFFU;
+			for (int j = 16; j != 0; j >>= 1, mask ^= mask << j) {
+				for (int k = 0; k < 32; k = (k + j + 1) & ~j) {
+					uint32_t t = ((block[k] >> j) ^ block[k + j]) & mask;
+					block[k] ^= t << j;
+					block[k + j] ^= t;
+				}
+			}
+			for (int i = 0; i < 32 && bj * 32 + i < qrsize; i++)
+				columns[bj * 32 + i][bi] = block[i];
+		}
+	}
+}
+
+
+// Returns the number of 1 bits in the given word.
+static int countOnes(uint32_t x) {
+#if defined(__GNUC__)
+	return __builtin_popcount(x);
+#else
+	x = x - ((x >> 1) & 0x55555555U);
+	x = (x & 0x33333333U) + ((x >> 2) & 0x33333333U);
+	return (int)((((x + (x >> 4)) & 0x0F0F0F0FU) * 0x01010101U) >> 24);
+#endif
+}
+
+
+// Returns the index of the lowest 1 bit in the given word, which must not be zero.
+static int countTrailingZeros(uint32_t x) {
+	assert(x != 0);
+#if defined(__GNUC__)
+	return __builtin_ctz(x);
+#else
+	int result = 0;
+	for (; (x & 1) == 0; x >>= 1)
+		result++;
+	return result;
+#endif
+}
+
+
+
 /*---- Segment handling ----*/
 
 // Public function - see documentation comment in header file.
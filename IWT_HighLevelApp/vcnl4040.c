@@ -60,19 +60,51 @@ const uint8_t VCNL4040_ADDR = 0x60; //7-bit unshifted I2C address of VCNL4040
 #define VCNL4040_INT_FLAG 0x0B //Upper
 #define VCNL4040_ID 0x0C
 
+//Command codes 0x00 to 0x07 are the writable ones, they are mirrored in a shadow copy
+#define VCNL4040_SHADOW_REGS 8
+
 //Extern variables
 int i2cFd = -1;
 
+//Shadow copy of the writable registers. A bit per register tells whether the copy is known,
+//read from or written to the device, and whether it has changes not written yet
+static uint16_t shadow[VCNL4040_SHADOW_REGS];
+static uint8_t shadowValid = 0;
+static uint8_t shadowDirty = 0;
+static int configureDepth = 0;
+static boolean configureFailed = false;
+
+static boolean readCommand(uint8_t commandCode, uint16_t* value);
+static uint8_t readCommandLower(uint8_t commandCode);
+static uint8_t readCommandUpper(uint8_t commandCode);
+
+static int writeCommand(const uint8_t regAddress, const uint16_t value);
+static boolean writeCommandLower(uint8_t commandCode, uint8_t newValue);
+static boolean writeCommandUpper(uint8_t commandCode, uint8_t newValue);
+
+static void bitMask(uint8_t commandAddress, boolean commandHeight, uint8_t mask, uint8_t thing);
+static void setRegister(uint8_t commandCode, uint16_t value);
+static boolean getRegister(uint8_t commandCode, uint16_t* value);
+
+static int initI2c(const int isu);
+static bool CheckTransferSize(const char* desc, size_t expectedBytes, ssize_t actualBytes);
+
 
 //Check comm with sensor and set it to default init settings
 boolean vcnl4040_begin(const int isu) {
 	
 
 	initI2c(isu);
+	//The sensor may keep the configuration of a previous run, read it again
+	shadowValid = 0;
+	shadowDirty = 0;
+	configureDepth = 0;
+	configureFailed = false;
 
 	vcnl4040_readWhoAmI();
 
-	//Configure the various parts of the sensor
+	//Configure the various parts of the sensor, the registers are written once at the end
+	vcnl4040_beginConfigure();
 	vcnl4040_setLEDCurrent(200); //Max IR LED current
 
 	vcnl4040_setIRDutyCycle(40); //Set to highest duty cycle
@@ -88,7 +120,74 @@ boolean vcnl4040_begin(const int isu) {
 	//vcnl4040_setAmbientIntegrationTime(VCNL4040_ALS_IT_80MS); //Keep it short
 	//vcnl4040_powerOnAmbient(); //Turn on ambient sensing
 
-	return (true);
+	return (vcnl4040_commitConfigure() == 0);
+}
+
+//Start a batch of configuration changes. The set, enable and threshold functions only update
+//the shadow copy until the matching vcnl4040_commitConfigure. Batches may nest
+void vcnl4040_beginConfigure(void)
+{
+  configureDepth++;
+}
+
+//Write every register changed since vcnl4040_beginConfigure, each one once and only if its
+//value differs from the device. Returns 0 on success, -1 if a register could not be read or
+//written, the changes to it are lost
+int vcnl4040_commitConfigure(void)
+{
+  if (configureDepth > 0) configureDepth--;
+  if (configureDepth > 0) return 0;
+
+  int result = configureFailed ? -1 : 0;
+  configureFailed = false;
+  for (uint8_t commandCode = 0; commandCode < VCNL4040_SHADOW_REGS; commandCode++)
+  {
+    if (shadowDirty & (1 << commandCode))
+    {
+      shadowDirty &= (uint8_t)~(1 << commandCode);
+      if (writeCommand(commandCode, shadow[commandCode]) != true)
+      {
+        shadowValid &= (uint8_t)~(1 << commandCode); //Unknown, read it again next time
+        result = -1;
+      }
+    }
+  }
+  return result;
+}
+
+//Set a whole register through the shadow copy. Nothing is written if the device already
+//holds the value, and nothing until the commit inside a configuration batch
+static void setRegister(uint8_t commandCode, uint16_t value)
+{
+  uint8_t bit = (uint8_t)(1 << commandCode);
+  if ((shadowValid & bit) && shadow[commandCode] == value && !(shadowDirty & bit)) return;
+  shadow[commandCode] = value;
+  shadowValid |= bit;
+  if (configureDepth > 0)
+  {
+    shadowDirty |= bit;
+    return;
+  }
+  shadowDirty &= (uint8_t)~bit;
+  if (writeCommand(commandCode, value) != true) shadowValid &= (uint8_t)~bit; //Unknown, read it again next time
+}
+
+//Register value from the shadow copy, read from the device until a read succeeds.
+//Returns false if the register could not be read, a batch then fails at the commit
+static boolean getRegister(uint8_t commandCode, uint16_t* value)
+{
+  uint8_t bit = (uint8_t)(1 << commandCode);
+  if (!(shadowValid & bit))
+  {
+    if (!readCommand(commandCode, &shadow[commandCode]))
+    {
+      if (configureDepth > 0) configureFailed = true;
+      return (false);
+    }
+    shadowValid |= bit;
+  }
+  *value = shadow[commandCode];
+  return (true);
 }
 
 //Test to see if the device is responding
@@ -230,6 +329,8 @@ void vcnl4040_disableActiveForceMode(void)
 void vcnl4040_takeSingleProxMeasurement(void)
 {
   bitMask(VCNL4040_PS_CONF3, LOWER, VCNL4040_PS_TRIG_MASK, VCNL4040_PS_TRIG_TRIGGER);
+  //The sensor clears the trigger bit by itself once the measurement is done
+  shadow[VCNL4040_PS_CONF3] &= (uint16_t)~VCNL4040_PS_TRIG_TRIGGER;
 }
 
 //Enable the white measurement channel
@@ -239,7 +340,7 @@ void vcnl4040_enableWhiteChannel(void)
 }
 void vcnl4040_disableWhiteChannel(void)
 {
-  bitMask(VCNL4040_PS_MS, UPPER, VCNL4040_WHITE_EN_MASK, VCNL4040_WHITE_ENABLE);
+  bitMask(VCNL4040_PS_MS, UPPER, VCNL4040_WHITE_EN_MASK, VCNL4040_WHITE_DISABLE);
 }
 
 //Enable the proximity detection logic output mode
@@ -276,55 +377,63 @@ void vcnl4040_setLEDCurrent(uint8_t currentValue)
 //with ambient light
 void vcnl4040_setProxCancellation(uint16_t cancelValue)
 {
-  writeCommand(VCNL4040_PS_CANC, cancelValue);
+  setRegister(VCNL4040_PS_CANC, cancelValue);
 }
 
 //Value that ALS must go above to trigger an interrupt
 void vcnl4040_setALSHighThreshold(uint16_t threshold)
 {
-  writeCommand(VCNL4040_ALS_THDH, threshold);
+  setRegister(VCNL4040_ALS_THDH, threshold);
 }
 
 //Value that ALS must go below to trigger an interrupt
 void vcnl4040_setALSLowThreshold(uint16_t threshold)
 {
-  writeCommand(VCNL4040_ALS_THDL, threshold);
+  setRegister(VCNL4040_ALS_THDL, threshold);
 }
 
 //Value that Proximity Sensing must go above to trigger an interrupt
 void vcnl4040_setProxHighThreshold(uint16_t threshold)
 {
-  writeCommand(VCNL4040_PS_THDH, threshold);
+  setRegister(VCNL4040_PS_THDH, threshold);
 }
 
 //Value that Proximity Sensing must go below to trigger an interrupt
 void vcnl4040_setProxLowThreshold(uint16_t threshold)
 {
-  writeCommand(VCNL4040_PS_THDL, threshold);
+  setRegister(VCNL4040_PS_THDL, threshold);
 }
 
 //Read the Proximity value
 uint16_t vcnl4040_getProximity(void)
 {
-  return (readCommand(VCNL4040_PS_DATA));
+  uint16_t proximity;
+  readCommand(VCNL4040_PS_DATA, &proximity);
+  return (proximity);
 }
 
 //Read the Ambient light value
 uint16_t vcnl4040_getAmbient(void)
 {
-  return (readCommand(VCNL4040_ALS_DATA));
+  uint16_t ambient;
+  readCommand(VCNL4040_ALS_DATA, &ambient);
+  return (ambient);
 }
 
 //Read the White light value
 uint16_t vcnl4040_getWhite(void)
 {
-  return (readCommand(VCNL4040_WHITE_DATA));
+  uint16_t white;
+  readCommand(VCNL4040_WHITE_DATA, &white);
+  return (white);
 }
 
 //Read the sensors ID
 uint16_t vcnl4040_getID(void)
 {
-  return (readCommand(VCNL4040_ID));
+  uint16_t id;
+  readCommand(VCNL4040_ID, &id);
+  return (id);
 }
 
 //Returns true if the prox value rises above the upper threshold
@@ -334,6 +443,12 @@ boolean vcnl4040_isClose(void)
   return (interruptFlags & VCNL4040_INT_FLAG_CLOSE);
 }
 
+//Reads the interrupt flags. Reading clears them, so all of them come from a single read
+uint8_t vcnl4040_getInterruptFlags(void)
+{
+  return readCommandUpper(VCNL4040_INT_FLAG);
+}
+
 //Returns true if the prox value drops below the lower threshold
 boolean vcnl4040_isAway(void)
 {
@@ -385,54 +500,68 @@ int vcnl4040_readWhoAmI(void)
 void vcnl4040_closeI2c(void) {
 
 	CloseFdAndPrintError(i2cFd, "i2c");
+	i2cFd = -1;
+	shadowValid = 0;
+	shadowDirty = 0;
 
 }
 
 
 
 //Given a command code (address) write to the lower byte without affecting the upper byte
+//The upper byte comes from the shadow copy
 static boolean writeCommandLower(uint8_t commandCode, uint8_t newValue)
 {
-  uint16_t commandValue = readCommand(commandCode);
+  uint16_t commandValue;
+  if (!getRegister(commandCode, &commandValue)) return (false);
   commandValue &= 0xFF00; //Remove lower 8 bits
   commandValue |= (uint16_t)newValue; //Mask in
-  return (writeCommand(commandCode, commandValue));
+  setRegister(commandCode, commandValue);
+  return (true);
 }
 
 //Given a command code (address) write to the upper byte without affecting the lower byte
+//The lower byte comes from the shadow copy
 static boolean writeCommandUpper(uint8_t commandCode, uint8_t newValue)
 {
-  uint16_t commandValue = readCommand(commandCode);
+  uint16_t commandValue;
+  if (!getRegister(commandCode, &commandValue)) return (false);
   commandValue &= 0x00FF; //Remove upper 8 bits
   commandValue |= (uint16_t)newValue << 8; //Mask in
-  return (writeCommand(commandCode, commandValue));
+  setRegister(commandCode, commandValue);
+  return (true);
 }
 
 //Given a command code (address) read the lower byte
 static uint8_t readCommandLower(uint8_t commandCode)
 {
-  uint16_t commandValue = readCommand(commandCode);
+  uint16_t commandValue;
+  readCommand(commandCode, &commandValue);
   return (commandValue & 0xFF);
 }
 
 //Given a command code (address) read the upper byte
 static uint8_t readCommandUpper(uint8_t commandCode)
 {
-  uint16_t commandValue = readCommand(commandCode);
+  uint16_t commandValue;
+  readCommand(commandCode, &commandValue);
   return (commandValue >> 8);
 }
 
 //Given a register, read it, mask it, and then set the thing
 //commandHeight is used to select between the upper or lower byte of command register
+//The register is read from the shadow copy, so this costs at most one I2C write
 //Example:
 //Write dutyValue into PS_CONF1, lower byte, using the Duty_Mask
 //bitMask(VCNL4040_PS_CONF1, LOWER, VCNL4040_PS_DUTY_MASK, dutyValue);
 static void bitMask(uint8_t commandAddress, boolean commandHeight, uint8_t mask, uint8_t thing)
 {
-  // Grab current register context
+  // Grab current register context, leave it alone if it can not be read
+  uint16_t registerValue;
+  if (!getRegister(commandAddress, &registerValue)) return;
   uint8_t registerContents;
-  if (commandHeight == LOWER) registerContents = readCommandLower(commandAddress);
-  else registerContents = readCommandUpper(commandAddress);
+  if (commandHeight == LOWER) registerContents = (uint8_t)(registerValue & 0xFF);
+  else registerContents = (uint8_t)(registerValue >> 8);
 
   // Zero-out the portions of the register we're interested in
   registerContents &= mask;
@@ -505,7 +634,8 @@ static bool CheckTransferSize(const char* desc, size_t expectedBytes, ssize_t ac
 
 
 //Reads two consecutive bytes from a given 'command code' location
-static uint16_t readCommand(uint8_t commandCode)
+//Returns false if the transfer failed, the value is then 0xFFFF as an idle bus reads
+static boolean readCommand(uint8_t commandCode, uint16_t* value)
 {
 	uint16_t answer;
 
@@ -515,15 +645,16 @@ static uint16_t readCommand(uint8_t commandCode)
 			&answer, sizeof(answer));
 	if (!CheckTransferSize("I2CMaster_WriteThenRead (readCommand)",
 		sizeof(commandCode) + sizeof(answer), transferredBytes)) {
-		return -1;
+		*value = 0xFFFF;
+		return (false);
 	}
-	return answer;
+	*value = answer;
+	return (true);
 }
 
 //Write two bytes to a given command code location (8 bits)
 static int writeCommand(const uint8_t regAddress, const uint16_t value)
 {
-	Log_Debug("Write [RegAddress = 0x%02x, Value = 0x%04x].\n", regAddress, value);
 	const uint8_t command[] = { regAddress, value & 0xFF,value >> 8 };
 	ssize_t transferredBytes =
 		I2CMaster_Write(i2cFd, VCNL4040_ADDR, command, sizeof(command));
@@ -104,13 +104,13 @@ static const uint8_t VCNL4040_PS_INT_BOTH = (1 << 1) | (1 << 0);
 
 static const uint8_t VCNL4040_PS_SMART_PERS_MASK = (uint8_t)~((1 << 4));
 static const uint8_t VCNL4040_PS_SMART_PERS_DISABLE = 0;
-static const uint8_t VCNL4040_PS_SMART_PERS_ENABLE = (1 << 1);
+static const uint8_t VCNL4040_PS_SMART_PERS_ENABLE = (1 << 4);
 
 static const uint8_t VCNL4040_PS_AF_MASK = (uint8_t)~((1 << 3));
 static const uint8_t VCNL4040_PS_AF_DISABLE = 0;
 static const uint8_t VCNL4040_PS_AF_ENABLE = (1 << 3);
 
-static const uint8_t VCNL4040_PS_TRIG_MASK = (uint8_t)~((1 << 3));
+static const uint8_t VCNL4040_PS_TRIG_MASK = (uint8_t)~((1 << 2));
 static const uint8_t VCNL4040_PS_TRIG_TRIGGER = (1 << 2);
 
 static const uint8_t VCNL4040_WHITE_EN_MASK = (uint8_t)~((1 << 7));
@@ -141,6 +141,9 @@ static const uint8_t VCNL4040_INT_FLAG_AWAY = (1 << 0);
 boolean vcnl4040_begin(const int isu);
 boolean vcnl4040_isConnected(void); //True if sensor responded to I2C query
 
+void vcnl4040_beginConfigure(void); //Batch the following configuration changes
+int vcnl4040_commitConfigure(void); //Write the registers changed by the batch, each once
+
 void vcnl4040_setIRDutyCycle(uint16_t dutyValue);
 
 void vcnl4040_setProxInterruptPersistance(uint8_t persValue);
@@ -191,24 +194,10 @@ boolean vcnl4040_isClose(void); //Interrupt flag: True if prox value greater tha
 boolean vcnl4040_isAway(void); //Interrupt flag: True if prox value lower than low threshold
 boolean vcnl4040_isLight(void); //Interrupt flag: True if ALS value higher than high threshold
 boolean vcnl4040_isDark(void); //Interrupt flag: True if ALS value lower than low threshold
+uint8_t vcnl4040_getInterruptFlags(void); //Read and clear every interrupt flag in one transaction
 
 int vcnl4040_readWhoAmI(void);
 void vcnl4040_closeI2c(void);
 
-static uint16_t readCommand(uint8_t commandCode);
-static uint8_t readCommandLower(uint8_t commandCode);
-static uint8_t readCommandUpper(uint8_t commandCode);
-
-static int writeCommand(const uint8_t regAddress, const uint16_t value);
-static boolean writeCommandLower(uint8_t commandCode, uint8_t newValue);
-static boolean writeCommandUpper(uint8_t commandCode, uint8_t newValue);
-
-static void bitMask(uint8_t commandAddress, boolean commandHeight, uint8_t mask, uint8_t thing);
-
-//////
-static int initI2c(const int isu);
-static bool CheckTransferSize(const char* desc, size_t expectedBytes, ssize_t actualBytes);
-static int writeCommand(const uint8_t regAddress, const uint16_t value);
 
-	
 #endif // VCNL4040_H
\ No newline at end of file
@@ -1,4 +1,9 @@
 #pragma once
 
 #include "mt3620_rdb.h"
-#define VCNL4040_ISU MT3620_RDB_HEADER4_ISU2_I2C
\ No newline at end of file
+#define VCNL4040_ISU MT3620_RDB_HEADER4_ISU2_I2C
+
+// The INT pin is open drain, active low. If it is wired to a GPIO, define it here and add the
+// GPIO to the Gpio capability of app_manifest.json: the interrupt flags are only read over
+// I2C when the pin is low.
+//#define VCNL4040_INT_GPIO MT3620_GPIO0
@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+# Enrique Albertos.
+# Licensed under the MIT License.
+"""Decode and verify I Was There compact binary tokens.
+
+The device builds them when IWT_COMPACT_TOKEN_PROFILE is defined in
+IWT_HighLevelApp/build_options.h. Layout, all fields big endian:
+
+  [0]       profile version (1)
+  [1..2]    device index
+  [3..6]    jti, random
+  [7..10]   iat, Unix time
+  [11..18]  HMAC-SHA256 of bytes 0..10 truncated to 64 bits
+
+The token is the raw content of the QR code (byte mode). Pass it as a hex
+string, or pipe the raw bytes through stdin with --raw.
+
+  python3 iwt_compact_token.py --key 123456781234567812345678 0100012c0e818c5fbda38624f06023f227c1e5
+
+prints device index 1, jti 2c0e818c-5fbda386 and iat 1606263686.
+"""
+
+import argparse
+import datetime
+import hashlib
+import hmac
+import struct
+import sys
+import time
+
+VERSION = 1
+CLAIMS_SIZE = 11
+MAC_SIZE = 8
+TOKEN_SIZE = CLAIMS_SIZE + MAC_SIZE
+
+
+def decode(token, key):
+    """Return the claims of a compact token as a dict, raise ValueError if invalid."""
+    if len(token) != TOKEN_SIZE:
+        raise ValueError("expected %d bytes, got %d" % (TOKEN_SIZE, len(token)))
+    version, device_index, jti, iat = struct.unpack(">BHII", token[:CLAIMS_SIZE])
+    if version != VERSION:
+        raise ValueError("unknown token version %d" % version)
+    mac = hmac.new(key, token[:CLAIMS_SIZE], hashlib.sha256).digest()[:MAC_SIZE]
+    if not hmac.compare_digest(mac, token[CLAIMS_SIZE:]):
+        raise ValueError("bad signature")
+    return {"version": version, "device": device_index, "jti": jti, "iat": iat}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode an I Was There compact token")
+    parser.add_argument("token", nargs="?", help="token bytes as a hex string")
+    parser.add_argument("--key", required=True, help="device shared key, as in app_manifest.json")
+    parser.add_argument("--raw", action="store_true", help="read the raw token bytes from stdin")
+    parser.add_argument("--max-age", type=int, default=0,
+                        help="reject tokens issued more than this many seconds ago")
+    args = parser.parse_args()
+
+    if args.raw:
+        token = sys.stdin.buffer.read()
+    elif args.token:
+        token = bytes.fromhex(args.token)
+    else:
+        parser.error("a hex token or --raw is required")
+
+    try:
+        claims = decode(token, args.key.encode())
+    except ValueError as error:
+        print("invalid token: %s" % error)
+        return 1
+
+    issued = datetime.datetime.fromtimestamp(claims["iat"], datetime.timezone.utc)
+    print("device index: %d" % claims["device"])
+    print("jti:          %08x-%08x" % (claims["jti"], claims["iat"]))
+    print("iat:          %d (%s)" % (claims["iat"], issued.isoformat()))
+    if args.max_age and time.time() - claims["iat"] > args.max_age:
+        print("invalid token: older than %d seconds" % args.max_age)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())